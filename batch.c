@@ -0,0 +1,234 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+
+// Input is read in large blocks into one buffer, and every complete line in
+// it is run in place, NUL-terminated where its newline was. The unfinished
+// line at the end of a block moves to the front before the next read, and
+// the buffer only grows for a line longer than a whole block.
+//
+// interpret() resets the VM's arena before each expression, so every line
+// compiles and runs in the memory the previous one used.
+
+// Runs the complete lines of one block, numbered from first, and writes
+// their results to out in order.
+typedef bool (*BlockRunner)(void* context, char** lines, size_t count, long first,
+                            OutputBuffer* out);
+
+typedef struct {
+    VM* vm;
+    FILE* errors;
+    char** messages;
+} SerialRunner;
+
+typedef struct {
+    WorkerPool* pool;
+    Job* jobs;
+    size_t capacity;
+} ParallelRunner;
+
+// Forward declarations
+
+static bool read_lines(int fd, OutputBuffer* out, BlockRunner, void* context);
+static bool run_serial(void* runner, char** lines, size_t count, long first, OutputBuffer*);
+static bool run_parallel(void* runner, char** lines, size_t count, long first, OutputBuffer*);
+static void write_result(OutputBuffer* out, long number, InterpreterResult, Value,
+                         const char* messages, size_t length);
+
+// Public
+
+bool run_batch(VM* vm, int fd, OutputBuffer* out) {
+    // Errors for the current line collect here instead of on stderr.
+    char* messages = NULL;
+    size_t messages_size = 0;
+    FILE* errors = open_memstream(&messages, &messages_size);
+    if (!errors) return false;
+
+    FILE* saved_errors = vm->errors;
+    vm->errors = errors;
+
+    SerialRunner runner = { vm, errors, &messages };
+    bool ok = read_lines(fd, out, run_serial, &runner);
+
+    vm->errors = saved_errors;
+    fclose(errors);
+    free(messages);
+    return ok;
+}
+
+bool run_batch_parallel(WorkerPool* pool, int fd, OutputBuffer* out) {
+    ParallelRunner runner = { pool, NULL, 0 };
+    bool ok = read_lines(fd, out, run_parallel, &runner);
+
+    free(runner.jobs);
+    return ok;
+}
+
+// Private
+
+static bool read_lines(int fd, OutputBuffer* out, BlockRunner run, void* context) {
+    size_t capacity = BATCH_BLOCK_SIZE + 1;
+    size_t length = 0;
+    char* buffer = malloc(capacity);
+    if (!buffer) return false;
+
+    size_t lines_capacity = 0;
+    char** lines = NULL;
+    long number = 0;
+    bool ok = true;
+
+    while (ok) {
+        if (length + 1 == capacity) {
+            char* grown = realloc(buffer, capacity * 2);
+            if (!grown) {
+                ok = false;
+                break;
+            }
+
+            buffer = grown;
+            capacity *= 2;
+        }
+
+        ssize_t bytes_read = read(fd, buffer + length, capacity - length - 1);
+        if (bytes_read < 0) {
+            ok = false;
+            break;
+        }
+
+        bool at_end = bytes_read == 0;
+        size_t end = length + (size_t)bytes_read;
+        size_t count = 0;
+        char* line = buffer;
+
+        // A last line with no newline after it ends the input instead.
+        if (at_end) {
+            if (length == 0) break;
+            buffer[end] = '\n';
+            end += 1;
+        }
+
+        // Only the bytes just read can hold a newline.
+        char* search = buffer + length;
+        char* newline;
+        while ((newline = memchr(search, '\n', end - (size_t)(search - buffer)))) {
+            *newline = '\0';
+            if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+
+            if (count == lines_capacity) {
+                size_t grown_capacity = lines_capacity < 1024 ? 1024 : lines_capacity * 2;
+                char** grown = realloc(lines, grown_capacity * sizeof(char*));
+                if (!grown) {
+                    ok = false;
+                    break;
+                }
+
+                lines = grown;
+                lines_capacity = grown_capacity;
+            }
+
+            lines[count++] = line;
+            line = newline + 1;
+            search = line;
+        }
+
+        if (ok && count > 0) ok = run(context, lines, count, number + 1, out);
+        number += (long)count;
+        if (at_end) break;
+
+        length = end - (size_t)(line - buffer);
+        memmove(buffer, line, length);
+    }
+
+    free(lines);
+    free(buffer);
+
+    if (!flush_output(out)) ok = false;
+    return ok;
+}
+
+static bool run_serial(void* context, char** lines, size_t count, long first,
+                       OutputBuffer* out) {
+    SerialRunner* runner = context;
+
+    for (size_t i = 0; i < count; i += 1) {
+        InterpreterResult result = interpret(runner->vm, lines[i]);
+
+        // The stream's buffer is only up to date after a flush, and still
+        // holds older, longer messages past the current position.
+        long written = 0;
+        if (result != INTERPRET_OK) {
+            fflush(runner->errors);
+            written = ftell(runner->errors);
+            fseek(runner->errors, 0, SEEK_SET);
+        }
+
+        write_result(out, first + (long)i, result, runner->vm->result,
+                     *runner->messages, written > 0 ? (size_t)written : 0);
+    }
+
+    return true;
+}
+
+static bool run_parallel(void* context, char** lines, size_t count, long first,
+                         OutputBuffer* out) {
+    ParallelRunner* runner = context;
+
+    if (runner->capacity < count) {
+        Job* grown = realloc(runner->jobs, count * sizeof(Job));
+        if (!grown) return false;
+
+        runner->jobs = grown;
+        runner->capacity = count;
+    }
+
+    for (size_t i = 0; i < count; i += 1) {
+        runner->jobs[i].source = lines[i];
+        runner->jobs[i].program = NULL;
+    }
+    run_jobs(runner->pool, runner->jobs, count);
+
+    for (size_t i = 0; i < count; i += 1) {
+        Job* job = &runner->jobs[i];
+        write_result(out, first + (long)i, job->status, job->result,
+                     job_errors(runner->pool, job), job->errors_length);
+    }
+
+    return true;
+}
+
+// Multi-line messages are joined with "; " to keep one line per result.
+static void write_result(OutputBuffer* out, long number, InterpreterResult result, Value value,
+                         const char* messages, size_t length) {
+    output_long(out, number);
+    output_char(out, '\t');
+
+    if (result == INTERPRET_OK) {
+        output_bytes(out, "ok\t", 3);
+        output_value(out, value);
+        output_char(out, '\n');
+        return;
+    }
+
+    output_string(out, result == INTERPRET_COMPILE_ERROR ? "compile_error\t" : "runtime_error\t");
+
+    while (length > 0 && messages[length - 1] == '\n') length -= 1;
+    while (length > 0) {
+        const char* newline = memchr(messages, '\n', length);
+        size_t line_length = newline ? (size_t)(newline - messages) : length;
+
+        output_bytes(out, messages, line_length);
+        if (!newline) break;
+
+        output_bytes(out, "; ", 2);
+        messages += line_length + 1;
+        length -= line_length + 1;
+    }
+    output_char(out, '\n');
+}
@@ -0,0 +1,30 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_BATCH_H
+#define LOX_BATCH_H
+
+#include "pool.h"
+#include "vm.h"
+
+// Bytes asked of each read() in batch mode.
+#define BATCH_BLOCK_SIZE (1024 * 1024)
+
+// Runs every newline-delimited expression read from fd through the one VM,
+// and writes one line per expression to out, which it flushes at the end:
+//
+//   <line number>\tok\t<value>
+//   <line number>\tcompile_error\t<messages>
+//   <line number>\truntime_error\t<messages>
+//
+// Line numbers count input lines from 1; the expression is not echoed.
+// Multi-line error messages are joined with "; ". A trailing '\r' on an
+// input line is dropped. Returns false only when fd cannot be read.
+bool run_batch(VM*, int fd, OutputBuffer* out);
+
+// The same, with each block's lines spread across the pool's workers.
+// Results are still written in input order.
+bool run_batch_parallel(WorkerPool*, int fd, OutputBuffer* out);
+
+#endif //LOX_BATCH_H
@@ -0,0 +1,363 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+// Benchmarks the three stages of the interpreter separately on synthetic
+// input of a chosen size, and prints the results as JSON:
+//
+//   scanner   scan_token over the whole source, in MB/s
+//   compiler  compile() of the same source, in MB/s
+//   tokenized compile_pretokenized() of the same source, in MB/s
+//   vm        interpret_chunk() over a generated arithmetic chunk, in Mops/s
+//   registers the same chunk on the register backend, translated once as
+//             lox_run() would, in stack Mops/s so the two compare directly
+//   jit       the same chunk compiled to native code, likewise; only in
+//             builds with a JIT
+//
+// Every figure is a throughput, so higher is better. Save the output of a
+// run and pass it back with --baseline to fail (exit status 1) when any
+// figure drops by more than the threshold.
+//
+// Usage: lox_bench [--size kilobytes] [--repetitions n]
+//                  [--baseline file] [--threshold fraction]
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../compiler.h"
+#include "../jit.h"
+#include "../regvm.h"
+#include "../scanner.h"
+#include "../vm.h"
+
+#define DEFAULT_SIZE_KB 4096
+#define DEFAULT_REPETITIONS 5
+#define DEFAULT_THRESHOLD 0.05
+
+typedef struct {
+    const char* name;
+    const char* unit;
+    double value;
+} Result;
+
+typedef struct {
+    size_t size;
+    int repetitions;
+    const char* baseline_path;
+    double threshold;
+} Options;
+
+// Arithmetic only: the compiler folds it all, but still has to scan, parse
+// and fold every token of it.
+static const char* fragments[] = {
+    "(1.25 * 3 + 48721) / 7 - -2\n",
+    "    // a comment that runs to the end of the line\n",
+    "(123456789.987654321 + 0.5 * 1000000)\n",
+    "\t\t-(1 - 2) * (3 / 4)\n\n\n",
+    "((((8))))\n",
+};
+
+static const OpCode vm_operators[] = { OP_ADD, OP_MULTIPLY, OP_SUBTRACT, OP_DIVIDE };
+
+// Forward declarations
+
+static void parse_options(Options*, int argc, const char* argv[]);
+static char* generate_source(size_t size);
+static void generate_chunk(Chunk*, size_t size);
+static double now_seconds(void);
+static double bench_scanner(const char* source, int repetitions);
+static double bench_compiler(const char* source, int repetitions, bool pretokenize);
+static double bench_vm(size_t size, int repetitions, bool use_registers, bool use_jit,
+                       long* instructions);
+static void print_results(Options*, Result*, int count);
+static bool compare_with_baseline(Options*, Result*, int count);
+
+// Main
+
+int main(int argc, const char* argv[]) {
+    Options options;
+    parse_options(&options, argc, argv);
+
+    char* source = generate_source(options.size);
+    if (!source) {
+        fprintf(stderr, "Not enough memory for a %zu KB source.\n", options.size / 1024);
+        return 1;
+    }
+
+    double megabytes = (double)strlen(source) / (1024 * 1024);
+    long instructions = 0;
+
+    Result results[] = {
+        { "scanner",   "MB/s",   megabytes / bench_scanner(source, options.repetitions) },
+        { "compiler",  "MB/s",   megabytes / bench_compiler(source, options.repetitions, false) },
+        { "tokenized", "MB/s",   megabytes / bench_compiler(source, options.repetitions, true) },
+        { "vm",        "Mops/s", 0 },
+        { "registers", "Mops/s", 0 },
+#ifdef JIT
+        { "jit",       "Mops/s", 0 },
+#endif
+    };
+    double vm_seconds = bench_vm(options.size, options.repetitions, false, false, &instructions);
+    results[3].value = (double)instructions / 1e6 / vm_seconds;
+    double registers_seconds = bench_vm(options.size, options.repetitions, true, false, &instructions);
+    results[4].value = (double)instructions / 1e6 / registers_seconds;
+#ifdef JIT
+    double jit_seconds = bench_vm(options.size, options.repetitions, false, true, &instructions);
+    results[5].value = (double)instructions / 1e6 / jit_seconds;
+#endif
+
+    int count = sizeof(results) / sizeof(results[0]);
+    print_results(&options, results, count);
+
+    free(source);
+
+    if (options.baseline_path && !compare_with_baseline(&options, results, count)) return 1;
+    return 0;
+}
+
+static void parse_options(Options* options, int argc, const char* argv[]) {
+    options->size = (size_t)DEFAULT_SIZE_KB * 1024;
+    options->repetitions = DEFAULT_REPETITIONS;
+    options->baseline_path = NULL;
+    options->threshold = DEFAULT_THRESHOLD;
+
+    int i = 1;
+    for (; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--size") == 0) {
+            options->size = (size_t)atol(argv[i + 1]) * 1024;
+        } else if (strcmp(argv[i], "--repetitions") == 0) {
+            options->repetitions = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            options->baseline_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--threshold") == 0) {
+            options->threshold = atof(argv[i + 1]);
+        } else {
+            break;
+        }
+    }
+
+    // Anything left over is an unknown flag or one missing its value.
+    if (i < argc || options->size == 0 || options->repetitions < 1) {
+        fprintf(stderr, "Usage: lox_bench [--size kilobytes] [--repetitions n]\n"
+                        "                 [--baseline file] [--threshold fraction]\n");
+        exit(64);
+    }
+}
+
+// One long expression: fragments joined with '+', about size bytes long.
+static char* generate_source(size_t size) {
+    char* source = malloc(size + 1);
+    if (!source) return NULL;
+
+    size_t length = 0;
+    bool has_operand = false;
+    int fragment_count = sizeof(fragments) / sizeof(fragments[0]);
+
+    for (int i = 0; ; i += 1) {
+        const char* fragment = fragments[(i * 7) % fragment_count];
+        size_t fragment_length = strlen(fragment);
+        if (length + fragment_length + 3 > size) break;
+
+        // Comments are not operands, so they need no '+' in front.
+        bool is_comment = fragment[strspn(fragment, " \t")] == '/';
+        if (!is_comment && has_operand) {
+            memcpy(source + length, "+ ", 2);
+            length += 2;
+        }
+
+        memcpy(source + length, fragment, fragment_length);
+        length += fragment_length;
+        has_operand = has_operand || !is_comment;
+    }
+
+    // Too small for any fragment; still hand the compiler an expression.
+    if (!has_operand) source[length++] = '0';
+
+    source[length] = '\0';
+    return source;
+}
+
+// The compiler folds every constant expression, so the VM gets a chunk built
+// by hand instead: a running number, with each step folding in a small
+// independent subexpression, "running +- (k1 op k2)", like the operator
+// trees real scripts compile to. It takes about one instruction per byte of
+// source size.
+static void generate_chunk(Chunk* chunk, size_t size) {
+    int constants[4];
+    constants[0] = add_constant(chunk, NUMBER_VAL(1.5));
+    constants[1] = add_constant(chunk, NUMBER_VAL(0.999));
+    constants[2] = add_constant(chunk, NUMBER_VAL(2));
+    constants[3] = add_constant(chunk, NUMBER_VAL(1.001));
+
+    write_chunk(chunk, OP_CONSTANT, 1);
+    write_chunk(chunk, (uint8_t)constants[0], 1);
+
+    int operator_count = sizeof(vm_operators) / sizeof(vm_operators[0]);
+    for (size_t i = 0; (size_t)chunk->count + 8 < size; i += 1) {
+        int line = (int)(i / 16) + 1;
+        write_chunk(chunk, OP_CONSTANT, line);
+        write_chunk(chunk, (uint8_t)constants[i % 4], line);
+        write_chunk(chunk, OP_CONSTANT, line);
+        write_chunk(chunk, (uint8_t)constants[(i + 1) % 4], line);
+        write_chunk(chunk, vm_operators[i % operator_count], line);
+        if (i % 5 == 4) write_chunk(chunk, OP_NEGATE, line);
+        write_chunk(chunk, i % 2 == 0 ? OP_ADD : OP_SUBTRACT, line);
+    }
+
+    write_chunk(chunk, OP_RETURN, (int)(size / 16) + 1);
+}
+
+static double now_seconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// Each benchmark returns the best of its repetitions, in seconds.
+
+static double bench_scanner(const char* source, int repetitions) {
+    double best = 0;
+
+    for (int repetition = 0; repetition < repetitions; repetition += 1) {
+        double start = now_seconds();
+
+        Scanner scanner;
+        init_scanner(&scanner, source);
+        while (scan_token(&scanner).type != TOKEN_EOF) continue;
+
+        double elapsed = now_seconds() - start;
+        if (repetition == 0 || elapsed < best) best = elapsed;
+    }
+
+    return best;
+}
+
+static double bench_compiler(const char* source, int repetitions, bool pretokenize) {
+    Arena arena;
+    init_arena(&arena);
+    double best = 0;
+
+    for (int repetition = 0; repetition < repetitions; repetition += 1) {
+        reset_arena(&arena);
+        Chunk chunk;
+        init_chunk(&chunk, &arena);
+
+        double start = now_seconds();
+        bool ok = pretokenize ? compile_pretokenized(source, &chunk, stderr)
+                              : compile(source, &chunk, stderr);
+        double elapsed = now_seconds() - start;
+
+        if (!ok) {
+            fprintf(stderr, "The generated source does not compile.\n");
+            exit(1);
+        }
+        if (repetition == 0 || elapsed < best) best = elapsed;
+    }
+
+    free_arena(&arena);
+    return best;
+}
+
+static double bench_vm(size_t size, int repetitions, bool use_registers, bool use_jit,
+                       long* instructions) {
+    VM vm;
+    init_vm(&vm);
+    vm.use_jit = use_jit;
+    vm.use_registers = use_registers;
+
+    Chunk chunk;
+    init_chunk(&chunk, &vm.arena);
+    generate_chunk(&chunk, size);
+
+    // Translate or compile once, outside the timed runs, as the first run
+    // or JIT_THRESHOLD runs would. Every run then goes through
+    // interpret_chunk(), like lox_run() does.
+    if (use_registers && !translation_for(&chunk)) {
+        fprintf(stderr, "The generated chunk does not translate to registers.\n");
+        exit(1);
+    }
+    if (use_jit && !(chunk.jit = compile_jit(&chunk))) {
+        fprintf(stderr, "The generated chunk does not compile to native code.\n");
+        exit(1);
+    }
+    // As if the chunk had earned its code by running.
+    if (use_jit) chunk.runs = JIT_THRESHOLD;
+
+    *instructions = 0;
+    for (int offset = 0; offset < chunk.count; offset += 1) {
+        if (chunk.code[offset] == OP_CONSTANT) offset += 1;
+        *instructions += 1;
+    }
+
+    double best = 0;
+    for (int repetition = 0; repetition < repetitions; repetition += 1) {
+        double start = now_seconds();
+        InterpreterResult result = interpret_chunk(&vm, &chunk);
+        double elapsed = now_seconds() - start;
+
+        if (result != INTERPRET_OK) {
+            fprintf(stderr, "The generated chunk failed to run.\n");
+            exit(1);
+        }
+        if (repetition == 0 || elapsed < best) best = elapsed;
+    }
+
+    free_chunk(&chunk);
+    free_vm(&vm);
+    return best;
+}
+
+static void print_results(Options* options, Result* results, int count) {
+    printf("{\n");
+    printf("  \"size_kb\": %zu,\n", options->size / 1024);
+    printf("  \"repetitions\": %d,\n", options->repetitions);
+    printf("  \"results\": [\n");
+
+    for (int i = 0; i < count; i += 1) {
+        printf("    { \"name\": \"%s\", \"unit\": \"%s\", \"value\": %.3f }%s\n",
+               results[i].name, results[i].unit, results[i].value, i + 1 < count ? "," : "");
+    }
+
+    printf("  ]\n");
+    printf("}\n");
+}
+
+// Only has to read what print_results writes, so it looks for each result's
+// name and takes the first "value" after it.
+static bool compare_with_baseline(Options* options, Result* results, int count) {
+    FILE* file = fopen(options->baseline_path, "rb");
+    if (!file) {
+        fprintf(stderr, "Could not read baseline '%s'.\n", options->baseline_path);
+        return false;
+    }
+
+    char baseline[4096];
+    size_t length = fread(baseline, 1, sizeof(baseline) - 1, file);
+    baseline[length] = '\0';
+    fclose(file);
+
+    bool ok = true;
+    for (int i = 0; i < count; i += 1) {
+        char key[64];
+        snprintf(key, sizeof(key), "\"name\": \"%s\"", results[i].name);
+
+        const char* entry = strstr(baseline, key);
+        const char* value = entry ? strstr(entry, "\"value\":") : NULL;
+        if (!value) {
+            fprintf(stderr, "%-10s missing from baseline\n", results[i].name);
+            continue;
+        }
+
+        double before = strtod(value + strlen("\"value\":"), NULL);
+        double change = before > 0 ? (results[i].value - before) / before : 0;
+        bool regressed = change < -options->threshold;
+
+        fprintf(stderr, "%-10s %12.3f -> %12.3f %-7s %+7.2f%%%s\n", results[i].name,
+                before, results[i].value, results[i].unit, change * 100,
+                regressed ? "  REGRESSION" : "");
+        if (regressed) ok = false;
+    }
+
+    return ok;
+}
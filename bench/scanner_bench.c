@@ -0,0 +1,125 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+// Measures scan_token throughput in MB/s for every scanner kernel this CPU
+// supports, and tokenize() into a TokenBuffer with the default kernels, on a
+// synthetic source shaped like our generated scripts.
+//
+// Usage: lox_scanner_bench [megabytes]
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../scanner.h"
+
+#define REPETITIONS 5
+
+static const char* fragments[] = {
+    "(1.25 * 3 + 48721) / 7 - -2 >= 10 == true\n",
+    "    // a comment that runs to the end of the line\n",
+    "some_identifier_name * another_one_42 + x\n",
+    "\"a string literal with a few words in it\" == nil\n",
+    "\t\t!(1 < 2) != false\n\n\n",
+    "123456789.987654321 + 0.5 * 1000000\n",
+};
+
+static char* generate_source(size_t size) {
+    char* source = malloc(size + 1);
+    if (!source) return NULL;
+
+    size_t length = 0;
+    int fragment_count = sizeof(fragments) / sizeof(fragments[0]);
+
+    for (int i = 0; ; i += 1) {
+        const char* fragment = fragments[(i * 7) % fragment_count];
+        size_t fragment_length = strlen(fragment);
+        if (length + fragment_length > size) break;
+
+        memcpy(source + length, fragment, fragment_length);
+        length += fragment_length;
+    }
+
+    source[length] = '\0';
+    return source;
+}
+
+static double now_seconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static double scan_all(const char* source, const ScanKernels* kernels, long* tokens) {
+    double start = now_seconds();
+
+    Scanner scanner;
+    init_scanner_with_kernels(&scanner, source, kernels);
+
+    long count = 0;
+    while (scan_token(&scanner).type != TOKEN_EOF) count += 1;
+
+    *tokens = count;
+    return now_seconds() - start;
+}
+
+static double tokenize_all(const char* source, long* tokens) {
+    double start = now_seconds();
+
+    TokenBuffer buffer;
+    init_token_buffer(&buffer, NULL);
+    tokenize(&buffer, source);
+
+    double elapsed = now_seconds() - start;
+    *tokens = buffer.count - 1;
+    free_token_buffer(&buffer);
+    return elapsed;
+}
+
+int main(int argc, const char* argv[]) {
+    size_t megabytes = argc > 1 ? (size_t)atol(argv[1]) : 32;
+    size_t size = megabytes * 1024 * 1024;
+
+    char* source = generate_source(size);
+    if (!source) {
+        fprintf(stderr, "Not enough memory for a %zu MB source.\n", megabytes);
+        return 1;
+    }
+
+    size_t length = strlen(source);
+    ScanKernel kinds[] = { SCAN_KERNEL_SCALAR, SCAN_KERNEL_SSE2, SCAN_KERNEL_AVX2 };
+    double scalar_rate = 0;
+
+    printf("%-8s %12s %10s %8s\n", "kernel", "tokens", "MB/s", "speedup");
+
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i += 1) {
+        const ScanKernels* kernels = scan_kernels(kinds[i]);
+        if (!kernels) continue;
+
+        long tokens = 0;
+        double best = 0;
+        for (int repetition = 0; repetition < REPETITIONS; repetition += 1) {
+            double elapsed = scan_all(source, kernels, &tokens);
+            if (repetition == 0 || elapsed < best) best = elapsed;
+        }
+
+        double rate = (double)length / (1024 * 1024) / best;
+        if (kinds[i] == SCAN_KERNEL_SCALAR) scalar_rate = rate;
+
+        printf("%-8s %12ld %10.1f %7.2fx\n", kernels->name, tokens, rate, rate / scalar_rate);
+    }
+
+    long tokens = 0;
+    double best = 0;
+    for (int repetition = 0; repetition < REPETITIONS; repetition += 1) {
+        double elapsed = tokenize_all(source, &tokens);
+        if (repetition == 0 || elapsed < best) best = elapsed;
+    }
+
+    double rate = (double)length / (1024 * 1024) / best;
+    printf("%-8s %12ld %10.1f %7.2fx\n", "tokenize", tokens, rate, rate / scalar_rate);
+
+    free(source);
+    return 0;
+}
@@ -0,0 +1,346 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "memory.h"
+#include "stack.h"
+
+// Layout, every integer little-endian:
+//
+//   "LOXC"  u32 version  u64 source hash
+//   u32 code count  u32 line run count  u32 constant count
+//   code bytes
+//   line runs as (u32 offset, u32 line)
+//   constants as a u8 tag followed by the u64 bits of numbers
+
+#define LOXC_MAGIC "LOXC"
+#define LOXC_HEADER_SIZE (4 + 4 + 8 + 4 + 4 + 4)
+
+typedef enum {
+    CONSTANT_NIL,
+    CONSTANT_FALSE,
+    CONSTANT_TRUE,
+    CONSTANT_NUMBER,
+} ConstantTag;
+
+typedef struct {
+    const uint8_t* current;
+    const uint8_t* end;
+} Reader;
+
+// Forward declarations
+
+static void write_u32(FILE*, uint32_t);
+static void write_u64(FILE*, uint64_t);
+static bool read_u8(Reader*, uint8_t*);
+static bool read_u32(Reader*, uint32_t*);
+static bool read_u64(Reader*, uint64_t*);
+
+static bool read_all(int fd, uint8_t* buffer, size_t size);
+static bool read_chunk(Reader*, uint64_t source_hash, Chunk*);
+static bool validate_chunk(Chunk*);
+
+// Public
+
+uint64_t hash_source(const char* source, size_t length) {
+    // FNV-1a.
+    uint64_t hash = (uint64_t)14695981039346656037u;
+    for (size_t i = 0; i < length; i += 1) {
+        hash ^= (uint8_t)source[i];
+        hash *= (uint64_t)1099511628211u;
+    }
+
+    return hash;
+}
+
+char* cache_path_for(const char* script_path) {
+    size_t length = strlen(script_path);
+    bool has_extension = length >= 4 && strcmp(script_path + length - 4, ".lox") == 0;
+
+    // "script.lox" becomes "script.loxc", anything else gets ".loxc" appended.
+    const char* suffix = has_extension ? "c" : ".loxc";
+    char* path = malloc(length + strlen(suffix) + 1);
+    if (!path) return NULL;
+
+    memcpy(path, script_path, length);
+    strcpy(path + length, suffix);
+    return path;
+}
+
+bool save_chunk_cache(const char* path, Chunk* chunk, uint64_t source_hash) {
+    // Write to a private file and rename it into place so that concurrent
+    // processes never observe a half-written cache.
+    size_t length = strlen(path);
+    char* temp_path = malloc(length + 32);
+    if (!temp_path) return false;
+    snprintf(temp_path, length + 32, "%s.%ld.tmp", path, (long)getpid());
+
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) {
+        free(temp_path);
+        return false;
+    }
+
+    fwrite(LOXC_MAGIC, 1, 4, file);
+    write_u32(file, LOXC_VERSION);
+    write_u64(file, source_hash);
+    write_u32(file, (uint32_t)chunk->count);
+    write_u32(file, (uint32_t)chunk->line_count);
+    write_u32(file, (uint32_t)chunk->constants.count);
+
+    fwrite(chunk->code, 1, chunk->count, file);
+
+    for (int i = 0; i < chunk->line_count; i += 1) {
+        write_u32(file, (uint32_t)chunk->lines[i].offset);
+        write_u32(file, (uint32_t)chunk->lines[i].line);
+    }
+
+    for (int i = 0; i < chunk->constants.count; i += 1) {
+        Value value = chunk->constants.values[i];
+
+        if (IS_NIL(value)) {
+            fputc(CONSTANT_NIL, file);
+        } else if (IS_BOOL(value)) {
+            fputc(AS_BOOL(value) ? CONSTANT_TRUE : CONSTANT_FALSE, file);
+        } else {
+            double number = AS_NUMBER(value);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(double));
+
+            fputc(CONSTANT_NUMBER, file);
+            write_u64(file, bits);
+        }
+    }
+
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(temp_path, path) == 0;
+    if (!ok) remove(temp_path);
+
+    free(temp_path);
+    return ok;
+}
+
+bool load_chunk_cache(const char* path, uint64_t source_hash, Chunk* chunk) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < LOXC_HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    // Every array is copied into the chunk anyway, so one read into a
+    // scratch buffer is all the file needs.
+    size_t size = (size_t)info.st_size;
+    uint8_t* buffer = malloc(size);
+    bool ok = buffer && read_all(fd, buffer, size);
+    close(fd);
+
+    if (ok) {
+        Reader reader = { buffer, buffer + size };
+        ok = read_chunk(&reader, source_hash, chunk);
+    }
+
+    free(buffer);
+
+    if (!ok) {
+        free_chunk(chunk);
+        return false;
+    }
+
+    return true;
+}
+
+// Private
+
+static bool read_all(int fd, uint8_t* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t bytes_read = read(fd, buffer, size);
+        if (bytes_read <= 0) return false;
+
+        buffer += bytes_read;
+        size -= (size_t)bytes_read;
+    }
+
+    return true;
+}
+
+static bool read_chunk(Reader* reader, uint64_t source_hash, Chunk* chunk) {
+    if (memcmp(reader->current, LOXC_MAGIC, 4) != 0) return false;
+    reader->current += 4;
+
+    uint32_t version, code_count, line_count, constant_count;
+    uint64_t hash;
+    if (!read_u32(reader, &version) || version != LOXC_VERSION) return false;
+    if (!read_u64(reader, &hash) || hash != source_hash) return false;
+    if (!read_u32(reader, &code_count) ||
+        !read_u32(reader, &line_count) ||
+        !read_u32(reader, &constant_count)) return false;
+
+    // Reject counts the file cannot possibly hold before allocating anything.
+    size_t remaining = (size_t)(reader->end - reader->current);
+    if (code_count == 0 || code_count > remaining ||
+        line_count == 0 || line_count > (remaining - code_count) / 8 ||
+        constant_count > CONSTANT_LONG_MAX + 1) return false;
+
+    chunk->capacity = (int)code_count;
+    chunk->count = (int)code_count;
+    chunk->code = GROW_ARRAY(chunk->arena, MEMORY_SITE_CODE, uint8_t, NULL, 0, code_count);
+    memcpy(chunk->code, reader->current, code_count);
+    reader->current += code_count;
+
+    chunk->line_capacity = (int)line_count;
+    chunk->line_count = (int)line_count;
+    chunk->lines = GROW_ARRAY(chunk->arena, MEMORY_SITE_LINES, LineStart, NULL, 0, line_count);
+    for (uint32_t i = 0; i < line_count; i += 1) {
+        uint32_t offset, line;
+        read_u32(reader, &offset);
+        read_u32(reader, &line);
+        chunk->lines[i].offset = (int)offset;
+        chunk->lines[i].line = (int)line;
+    }
+
+    for (uint32_t i = 0; i < constant_count; i += 1) {
+        uint8_t tag;
+        if (!read_u8(reader, &tag)) return false;
+
+        Value value;
+        switch (tag) {
+            case CONSTANT_NIL:   value = NIL_VAL; break;
+            case CONSTANT_FALSE: value = BOOL_VAL(false); break;
+            case CONSTANT_TRUE:  value = BOOL_VAL(true); break;
+            case CONSTANT_NUMBER: {
+                uint64_t bits;
+                if (!read_u64(reader, &bits)) return false;
+
+                double number;
+                memcpy(&number, &bits, sizeof(double));
+                value = NUMBER_VAL(number);
+                break;
+            }
+            default:
+                return false;
+        }
+
+        // A well-formed file never holds duplicates, so every constant
+        // must land in its own slot.
+        if (add_constant(chunk, value) != (int)i) return false;
+    }
+
+    return reader->current == reader->end && validate_chunk(chunk);
+}
+
+// Makes sure a corrupted file cannot send the VM outside the chunk or its
+// stack: every instruction must find its operands on the stack, no push may
+// go past STACK_MAX, and OP_RETURN must leave nothing behind its result.
+// Chunks the compiler produced that deep are recompiled, so the overflow is
+// still reported when they run.
+static bool validate_chunk(Chunk* chunk) {
+    int offset = 0;
+    int depth = 0;
+    uint8_t last = OP_RETURN;
+
+    while (offset < chunk->count) {
+        last = chunk->code[offset];
+        int constant = -1;
+        int arity = 2;
+
+        switch (last) {
+            case OP_CONSTANT:
+                if (offset + 2 > chunk->count) return false;
+                constant = chunk->code[offset + 1];
+                arity = 0;
+                offset += 2;
+                break;
+            case OP_CONSTANT_LONG:
+                if (offset + 4 > chunk->count) return false;
+                constant = chunk->code[offset + 1] |
+                           (chunk->code[offset + 2] << 8) |
+                           (chunk->code[offset + 3] << 16);
+                arity = 0;
+                offset += 4;
+                break;
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+                arity = 0;
+                offset += 1;
+                break;
+            case OP_NOT:
+            case OP_NEGATE:
+            case OP_RETURN:
+                arity = 1;
+                offset += 1;
+                break;
+            default:
+                // Quickened opcodes are written by the VM, never compiled.
+                if (last > OP_RETURN) return false;
+                offset += 1;
+                break;
+        }
+
+        if (constant >= chunk->constants.count) return false;
+
+        if (depth < arity) return false;
+        if (last == OP_RETURN && depth != 1) return false;
+
+        // Every instruction but OP_RETURN leaves one result.
+        depth += (last == OP_RETURN ? 0 : 1) - arity;
+        if (depth > STACK_MAX) return false;
+    }
+
+    if (last != OP_RETURN || chunk->lines[0].offset != 0) return false;
+
+    for (int i = 1; i < chunk->line_count; i += 1) {
+        if (chunk->lines[i].offset <= chunk->lines[i - 1].offset ||
+            chunk->lines[i].offset >= chunk->count) return false;
+    }
+
+    return true;
+}
+
+static void write_u32(FILE* file, uint32_t value) {
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i += 1) bytes[i] = (uint8_t)(value >> (8 * i));
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+static void write_u64(FILE* file, uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i += 1) bytes[i] = (uint8_t)(value >> (8 * i));
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+static bool read_u8(Reader* reader, uint8_t* value) {
+    if (reader->end - reader->current < 1) return false;
+    *value = *reader->current++;
+    return true;
+}
+
+static bool read_u32(Reader* reader, uint32_t* value) {
+    if (reader->end - reader->current < 4) return false;
+
+    *value = 0;
+    for (int i = 0; i < 4; i += 1) *value |= (uint32_t)reader->current[i] << (8 * i);
+    reader->current += 4;
+    return true;
+}
+
+static bool read_u64(Reader* reader, uint64_t* value) {
+    if (reader->end - reader->current < 8) return false;
+
+    *value = 0;
+    for (int i = 0; i < 8; i += 1) *value |= (uint64_t)reader->current[i] << (8 * i);
+    reader->current += 8;
+    return true;
+}
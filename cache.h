@@ -0,0 +1,22 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_CACHE_H
+#define LOX_CACHE_H
+
+#include <stddef.h>
+
+#include "chunk.h"
+
+// Precompiled chunks are stored next to their script as .loxc files.
+// Bump the version whenever the file layout or the opcode numbering changes.
+#define LOXC_VERSION 1
+
+uint64_t hash_source(const char* source, size_t length);
+char* cache_path_for(const char* script_path);
+
+bool save_chunk_cache(const char* path, Chunk*, uint64_t source_hash);
+bool load_chunk_cache(const char* path, uint64_t source_hash, Chunk*);
+
+#endif //LOX_CACHE_H
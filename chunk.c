@@ -3,39 +3,146 @@
 //
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
+#include "jit.h"
 #include "memory.h"
+#include "regvm.h"
 
-void init_chunk(Chunk* chunk) {
+void init_chunk(Chunk* chunk, Arena* arena) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
+    chunk->line_capacity = 0;
+    chunk->line_count = 0;
     chunk->lines = NULL;
-    init_value_array(&chunk->constants);
+    init_value_array(&chunk->constants, arena);
+    chunk->arena = arena;
+    chunk->constant_index_capacity = 0;
+    chunk->constant_index = NULL;
+    chunk->runs = 0;
+    chunk->jit = NULL;
+    chunk->registers = NULL;
 }
 
 void write_chunk(Chunk* chunk, uint8_t byte, int line) {
     if (chunk->capacity < chunk->count + 1) {
         int old_capacity = chunk -> capacity;
         chunk->capacity = GROW_CAPACITY(old_capacity);
-        chunk->code = GROW_ARRAY(uint8_t, chunk->code, old_capacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int, chunk->lines, old_capacity, chunk->capacity);
+        chunk->code = GROW_ARRAY(chunk->arena, MEMORY_SITE_CODE, uint8_t, chunk->code, old_capacity, chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count += 1;
+
+    // Only start a new run when the line changes.
+    if (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].line == line) return;
+
+    if (chunk->line_capacity < chunk->line_count + 1) {
+        int old_capacity = chunk->line_capacity;
+        chunk->line_capacity = GROW_CAPACITY(old_capacity);
+        chunk->lines = GROW_ARRAY(chunk->arena, MEMORY_SITE_LINES, LineStart, chunk->lines, old_capacity, chunk->line_capacity);
+    }
+
+    LineStart* line_start = &chunk->lines[chunk->line_count];
+    line_start->offset = chunk->count - 1;
+    line_start->line = line;
+    chunk->line_count += 1;
+}
+
+// Drops every byte from count onwards. Constants are kept.
+void truncate_chunk(Chunk* chunk, int count) {
+    if (count >= chunk->count) return;
+
+    chunk->count = count;
+    while (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].offset >= count) {
+        chunk->line_count -= 1;
+    }
+}
+
+// Returns the slot where value lives or should be inserted.
+static int* find_constant_slot(int* index, int capacity, ValueArray* constants, Value value) {
+    uint32_t slot = hash_value(value) & (capacity - 1);
+
+    while (true) {
+        int* entry = &index[slot];
+        if (*entry == 0 || values_identical(constants->values[*entry - 1], value)) return entry;
+
+        slot = (slot + 1) & (capacity - 1);
+    }
+}
+
+static void grow_constant_index(Chunk* chunk) {
+    int old_capacity = chunk->constant_index_capacity;
+    int capacity = GROW_CAPACITY(old_capacity);
+    int* index = GROW_ARRAY(chunk->arena, MEMORY_SITE_CONSTANT_INDEX, int, NULL, 0, capacity);
+    memset(index, 0, sizeof(int) * capacity);
+
+    for (int i = 0; i < chunk->constants.count; i += 1) {
+        *find_constant_slot(index, capacity, &chunk->constants, chunk->constants.values[i]) = i + 1;
+    }
+
+    FREE_ARRAY(chunk->arena, MEMORY_SITE_CONSTANT_INDEX, int, chunk->constant_index, old_capacity);
+    chunk->constant_index = index;
+    chunk->constant_index_capacity = capacity;
 }
 
 int add_constant(Chunk* chunk, Value value) {
+    // Keep the index at most half full so probe sequences stay short.
+    if (chunk->constant_index_capacity < (chunk->constants.count + 1) * 2) {
+        grow_constant_index(chunk);
+    }
+
+    int* entry = find_constant_slot(chunk->constant_index, chunk->constant_index_capacity,
+                                    &chunk->constants, value);
+    if (*entry != 0) return *entry - 1;
+
     write_value_array(&chunk->constants, value);
+    *entry = chunk->constants.count;
     return chunk->constants.count - 1;
 }
 
+int get_line(Chunk* chunk, int offset) {
+    // Binary search for the last run that starts at or before offset.
+    int start = 0;
+    int end = chunk->line_count - 1;
+
+    while (start < end) {
+        int mid = start + (end - start + 1) / 2;
+        if (chunk->lines[mid].offset <= offset) {
+            start = mid;
+        } else {
+            end = mid - 1;
+        }
+    }
+
+    return chunk->lines[start].line;
+}
+
+OpCode generic_opcode(uint8_t opcode) {
+    switch (opcode) {
+        case OP_ADD_NUM:           return OP_ADD;
+        case OP_SUBTRACT_NUM:      return OP_SUBTRACT;
+        case OP_MULTIPLY_NUM:      return OP_MULTIPLY;
+        case OP_DIVIDE_NUM:        return OP_DIVIDE;
+        case OP_GREATER_NUM:       return OP_GREATER;
+        case OP_GREATER_EQUAL_NUM: return OP_GREATER_EQUAL;
+        case OP_LESS_NUM:          return OP_LESS;
+        case OP_LESS_EQUAL_NUM:    return OP_LESS_EQUAL;
+        case OP_EQUAL_NUM:         return OP_EQUAL;
+        case OP_NOT_EQUAL_NUM:     return OP_NOT_EQUAL;
+        case OP_NEGATE_NUM:        return OP_NEGATE;
+        default:                   return (OpCode)opcode;
+    }
+}
+
 void free_chunk(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(chunk->arena, MEMORY_SITE_CODE, uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(chunk->arena, MEMORY_SITE_LINES, LineStart, chunk->lines, chunk->line_capacity);
     free_value_array(&chunk->constants);
-    init_chunk(chunk);
+    FREE_ARRAY(chunk->arena, MEMORY_SITE_CONSTANT_INDEX, int, chunk->constant_index, chunk->constant_index_capacity);
+    free_jit(chunk->jit);
+    free_translation(chunk->registers);
+    init_chunk(chunk, chunk->arena);
 }
\ No newline at end of file
@@ -8,34 +8,95 @@
 #include "common.h"
 #include "value.h"
 
+// Largest constant index that fits in the 24-bit operand of OP_CONSTANT_LONG.
+#define CONSTANT_LONG_MAX 0xffffff
+
 typedef enum {
     OP_CONSTANT,
+    OP_CONSTANT_LONG,
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
     OP_EQUAL,
+    OP_NOT_EQUAL,
     OP_GREATER,
+    OP_GREATER_EQUAL,
     OP_LESS,
+    OP_LESS_EQUAL,
     OP_ADD,
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
-    OP_RETURN
+    OP_RETURN,
+
+    // Quickened forms. The VM rewrites a generic instruction into one of
+    // these once it has seen number operands, and back when that stops
+    // holding. They only ever appear in code that has run, never in compiled
+    // or cached chunks.
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_GREATER_NUM,
+    OP_GREATER_EQUAL_NUM,
+    OP_LESS_NUM,
+    OP_LESS_EQUAL_NUM,
+    OP_EQUAL_NUM,
+    OP_NOT_EQUAL_NUM,
+    OP_NEGATE_NUM
 } OpCode;
 
+// Native code for a chunk, see jit.h.
+typedef struct JitCode JitCode;
+
+// The register form of a chunk, see regvm.h.
+typedef struct RegChunk RegChunk;
+
+// A run of bytecode emitted from the same source line, starting at offset.
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
 typedef struct {
     int capacity;
     int count;
     uint8_t* code;
-    int* lines;
+
+    int line_capacity;
+    int line_count;
+    LineStart* lines;
+
     ValueArray constants;
+    // Where every array of this chunk is allocated; NULL for the heap.
+    Arena* arena;
+
+    // Open-addressed index into constants used to share slots between
+    // identical values. Each slot holds a constant index plus one, or zero.
+    int constant_index_capacity;
+    int* constant_index;
+
+    // Runs counted by interpret_chunk(), up to JIT_THRESHOLD, and the native
+    // code it compiled the chunk to then. NULL until then, or for good when
+    // the chunk could not be compiled.
+    int runs;
+    JitCode* jit;
+
+    // The translation made by the first run on the register backend, in the
+    // chunk's arena, and reused by every later one. NULL until then.
+    RegChunk* registers;
 } Chunk;
 
-void init_chunk(Chunk*);
+void init_chunk(Chunk*, Arena*);
 void write_chunk(Chunk*, uint8_t byte, int line);
+void truncate_chunk(Chunk*, int count);
 int add_constant(Chunk*, Value);
+int get_line(Chunk*, int offset);
 void free_chunk(Chunk*);
 
+// The generic opcode a quickened one stands for; any other opcode is its own.
+OpCode generic_opcode(uint8_t opcode);
+
 #endif //LOX_CHUNK_H
@@ -9,7 +9,26 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#define DEBUG_TRACE_EXECUTION
-#define DEBUG_PRINT_CODE
+// Pack every Value into a single 64-bit word. Build with -DLOX_NO_NAN_BOXING
+// to fall back to the tagged-union representation.
+#ifndef LOX_NO_NAN_BOXING
+#define NAN_BOXING
+#endif
+
+// Thread the dispatch loop through a table of label addresses on compilers
+// that support it. Build with -DLOX_NO_COMPUTED_GOTO to use the portable switch.
+#if defined(__GNUC__) && !defined(LOX_NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+
+// Compile hot chunks to x86-64 machine code, see jit.h. The generated code
+// relies on the NaN-boxed layout of values. Build with -DLOX_NO_JIT to always
+// interpret.
+#if defined(__x86_64__) && defined(__linux__) && defined(NAN_BOXING) && !defined(LOX_NO_JIT)
+#define JIT
+#endif
+
+// Build with -DDEBUG_PRINT_CODE to dump every compiled chunk. Execution is
+// traced at runtime instead, see trace.h.
 
 #endif //LOX_COMMON_H
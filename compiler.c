@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include "compiler.h"
+#include "optimizer.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
@@ -12,6 +13,7 @@
 
 // Forward declarations
 
+static bool compile_with(Parser*, Chunk*, FILE* errors);
 static void advance(Parser*);
 static void consume(Parser*, TokenType, const char* message);
 
@@ -19,9 +21,17 @@ static void error_at(Parser*, Token*, const char* message);
 static void error(Parser*, const char* message);
 static void error_at_current(Parser*, const char* message);
 
+static Chunk* current_chunk(Parser*);
+
 static void emit_byte(Parser*, uint8_t);
 static void emit_bytes(Parser*, uint8_t, uint8_t);
+static void emit_op(Parser*, OpCode);
 static void emit_constant(Parser*, Value);
+static void emit_value(Parser*, Value);
+
+static bool read_constant(Chunk*, int start, int end, Value*);
+static bool fold_unary(TokenType, Value, Value*);
+static bool fold_binary(TokenType, Value, Value, Value*);
 
 static void end_compiler(Parser*);
 
@@ -39,11 +49,13 @@ typedef void (*ParseFn)(Parser*);
 typedef struct {
     ParseFn prefix;
     ParseFn infix;
-    Precedence  precedence
+    Precedence precedence;
 } ParseRule;
 
-static ParseRule* get_rule(TokenType);
-ParseRule rules[] = {
+static const ParseRule* get_rule(TokenType);
+
+// Shared by every compiler on every thread, so it must stay read-only.
+static const ParseRule rules[] = {
     [TOKEN_LEFT_PAREN]    = {grouping, NULL,   PREC_NONE},
     [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
     [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE},
@@ -88,34 +100,55 @@ ParseRule rules[] = {
 
 // Public
 
-bool compile(const char* source, Chunk* chunk) {
-    Scanner scanner;
-    init_scanner(&scanner, source);
-
-    Parser parser = {
-        .scanner = &scanner,
-        .panic_mode = false,
-        .had_error = false,
+bool compile(const char* source, Chunk* chunk, FILE* errors) {
+    Parser parser = { .tokens = NULL, .fold = true };
+    init_scanner(&parser.scanner, source);
+    return compile_with(&parser, chunk, errors);
+}
 
-        .compiling_chunk = chunk,
-    };
+bool compile_pretokenized(const char* source, Chunk* chunk, FILE* errors) {
+    TokenBuffer tokens;
+    init_token_buffer(&tokens, chunk->arena);
+    tokenize(&tokens, source);
 
-    advance(&parser);
-    expression(&parser);
+    Parser parser = { .tokens = &tokens, .fold = true };
+    bool ok = compile_with(&parser, chunk, errors);
 
-    consume(&parser, TOKEN_EOF, "Expect end of expression.");
-    end_compiler(&parser);
+    free_token_buffer(&tokens);
+    return ok;
+}
 
-    return !parser.had_error;
+bool compile_unfolded(const char* source, Chunk* chunk, FILE* errors) {
+    Parser parser = { .tokens = NULL, .fold = false };
+    init_scanner(&parser.scanner, source);
+    return compile_with(&parser, chunk, errors);
 }
 
 // Private
 
+// Compiles from whichever token source the parser was given.
+static bool compile_with(Parser* parser, Chunk* chunk, FILE* errors) {
+    parser->next_token = 0;
+    parser->panic_mode = false;
+    parser->had_error = false;
+    parser->errors = errors;
+    parser->compiling_chunk = chunk;
+    parser->last_instruction = -1;
+
+    advance(parser);
+    expression(parser);
+
+    consume(parser, TOKEN_EOF, "Expect end of expression.");
+    end_compiler(parser);
+
+    return !parser->had_error;
+}
+
 static void literal(Parser* parser) {
     switch (parser->previous.type) {
-        case TOKEN_FALSE: emit_byte(parser, OP_FALSE); break;
-        case TOKEN_NIL:   emit_byte(parser, OP_NIL); break;
-        case TOKEN_TRUE:  emit_byte(parser, OP_TRUE); break;
+        case TOKEN_FALSE: emit_op(parser, OP_FALSE); break;
+        case TOKEN_NIL:   emit_op(parser, OP_NIL); break;
+        case TOKEN_TRUE:  emit_op(parser, OP_TRUE); break;
         default:
             return; // Unreachable.
     }
@@ -125,21 +158,37 @@ static void binary(Parser* parser) {
     // Remember the operator.
     TokenType operator_type = parser->previous.type;
 
+    // The left operand has already been compiled; it is a constant if it
+    // was a single load ending where the right operand starts.
+    Chunk* chunk = current_chunk(parser);
+    int left_start = parser->last_instruction;
+    int right_start = chunk->count;
+
     // Compile the right operand.
-    ParseRule* rule = get_rule(operator_type);
+    const ParseRule* rule = get_rule(operator_type);
     parse_precedence(parser, (Precedence) (rule->precedence + 1));
 
+    Value a, b, result;
+    if (parser->fold && left_start >= 0 &&
+        read_constant(chunk, left_start, right_start, &a) &&
+        read_constant(chunk, right_start, chunk->count, &b) &&
+        fold_binary(operator_type, a, b, &result)) {
+        truncate_chunk(chunk, left_start);
+        emit_value(parser, result);
+        return;
+    }
+
     switch (operator_type) {
-        case TOKEN_BANG_EQUAL:    emit_bytes(parser, OP_EQUAL, OP_NOT); break;
-        case TOKEN_EQUAL_EQUAL:   emit_byte(parser, OP_EQUAL); break;
-        case TOKEN_GREATER:       emit_byte(parser, OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emit_bytes(parser, OP_LESS, OP_NOT); break;
-        case TOKEN_LESS:          emit_byte(parser, OP_LESS); break;
-        case TOKEN_LESS_EQUAL:    emit_bytes(parser, OP_GREATER, OP_NOT); break;
-        case TOKEN_PLUS:  emit_byte(parser, OP_ADD); break;
-        case TOKEN_MINUS: emit_byte(parser, OP_SUBTRACT); break;
-        case TOKEN_STAR:  emit_byte(parser, OP_MULTIPLY); break;
-        case TOKEN_SLASH: emit_byte(parser, OP_DIVIDE); break;
+        case TOKEN_BANG_EQUAL:    emit_op(parser, OP_NOT_EQUAL); break;
+        case TOKEN_EQUAL_EQUAL:   emit_op(parser, OP_EQUAL); break;
+        case TOKEN_GREATER:       emit_op(parser, OP_GREATER); break;
+        case TOKEN_GREATER_EQUAL: emit_op(parser, OP_GREATER_EQUAL); break;
+        case TOKEN_LESS:          emit_op(parser, OP_LESS); break;
+        case TOKEN_LESS_EQUAL:    emit_op(parser, OP_LESS_EQUAL); break;
+        case TOKEN_PLUS:  emit_op(parser, OP_ADD); break;
+        case TOKEN_MINUS: emit_op(parser, OP_SUBTRACT); break;
+        case TOKEN_STAR:  emit_op(parser, OP_MULTIPLY); break;
+        case TOKEN_SLASH: emit_op(parser, OP_DIVIDE); break;
         default: return; // Unreachable
     }
 }
@@ -152,16 +201,27 @@ static void unary(Parser* parser) {
     TokenType operator_type = parser->previous.type;
 
     // Compile the operand.
+    Chunk* chunk = current_chunk(parser);
+    int operand_start = chunk->count;
     parse_precedence(parser, PREC_UNARY);
 
+    Value operand, result;
+    if (parser->fold &&
+        read_constant(chunk, operand_start, chunk->count, &operand) &&
+        fold_unary(operator_type, operand, &result)) {
+        truncate_chunk(chunk, operand_start);
+        emit_value(parser, result);
+        return;
+    }
+
     // Emit the operator instruction.
     switch (operator_type) {
         case TOKEN_BANG: {
-            emit_byte(parser, OP_NOT);
+            emit_op(parser, OP_NOT);
             break;
         }
         case TOKEN_MINUS: {
-            emit_byte(parser, OP_NEGATE);
+            emit_op(parser, OP_NEGATE);
             break;
         }
         default:
@@ -170,8 +230,7 @@ static void unary(Parser* parser) {
 }
 
 static void number(Parser* parser) {
-    double value = strtod(parser->previous.start, NULL);
-    emit_constant(parser, NUMBER_VAL(value));
+    emit_constant(parser, NUMBER_VAL(parser->previous.number));
 }
 
 static void grouping(Parser* parser) {
@@ -183,7 +242,14 @@ static void advance(Parser* parser) {
     parser->previous = parser->current;
 
     while (true) {
-        parser->current = scan_token(parser->scanner);
+        if (parser->tokens) {
+            // The buffer always ends in TOKEN_EOF, which is returned forever.
+            parser->current = token_at(parser->tokens, parser->next_token);
+            if (parser->next_token < parser->tokens->count - 1) parser->next_token += 1;
+        } else {
+            parser->current = scan_token(&parser->scanner);
+        }
+
         if (parser->current.type != TOKEN_ERROR) break;
 
         error_at_current(parser, parser->current.start);
@@ -202,17 +268,17 @@ static void error_at(Parser* parser, Token* token, const char* message) {
     if (parser->panic_mode) return;
     parser->panic_mode = true;
 
-    fprintf(stderr, "[line %d] Error", token->line);
+    fprintf(parser->errors, "[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(parser->errors, " at end");
     } else if (token->type == TOKEN_ERROR) {
         // Nothing.
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(parser->errors, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", message);
+    fprintf(parser->errors, ": %s\n", message);
     parser->had_error = true;
 }
 
@@ -229,7 +295,7 @@ static Chunk* current_chunk(Parser* parser) {
     return parser->compiling_chunk;
 }
 
-static ParseRule* get_rule(TokenType type) {
+static const ParseRule* get_rule(TokenType type) {
     return &rules[type];
 }
 
@@ -261,26 +327,126 @@ static void emit_bytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
     emit_byte(parser, byte2);
 }
 
+static void emit_op(Parser* parser, OpCode op) {
+    parser->last_instruction = current_chunk(parser)->count;
+    emit_byte(parser, op);
+}
+
 static void emit_return(Parser* parser) {
-    emit_byte(parser, OP_RETURN);
+    emit_op(parser, OP_RETURN);
 }
 
-static uint8_t make_constant(Parser* parser, Value value) {
+static int make_constant(Parser* parser, Value value) {
     int constant = add_constant(current_chunk(parser), value);
-    if (constant > UINT8_MAX) {
+    if (constant > CONSTANT_LONG_MAX) {
         error(parser, "Too many constants in one chunk.");
         return 0;
     }
 
-    return (uint8_t) constant;
+    return constant;
 }
 
 static void emit_constant(Parser* parser, Value value) {
-    emit_bytes(parser, OP_CONSTANT, make_constant(parser, value));
+    int constant = make_constant(parser, value);
+
+    if (constant <= UINT8_MAX) {
+        emit_op(parser, OP_CONSTANT);
+        emit_byte(parser, (uint8_t) constant);
+    } else {
+        // 24-bit little-endian operand.
+        emit_op(parser, OP_CONSTANT_LONG);
+        emit_bytes(parser, (uint8_t) (constant & 0xff), (uint8_t) ((constant >> 8) & 0xff));
+        emit_byte(parser, (uint8_t) ((constant >> 16) & 0xff));
+    }
+}
+
+// Emits the cheapest instruction that loads value.
+static void emit_value(Parser* parser, Value value) {
+    if (IS_NIL(value)) {
+        emit_op(parser, OP_NIL);
+    } else if (IS_BOOL(value)) {
+        emit_op(parser, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emit_constant(parser, value);
+    }
+}
+
+// Constant folding
+
+// Reads the value loaded by the code in [start, end) if that range is a
+// single constant-producing instruction.
+static bool read_constant(Chunk* chunk, int start, int end, Value* value) {
+    if (start >= end) return false;
+
+    switch (chunk->code[start]) {
+        case OP_NIL:   *value = NIL_VAL; return end - start == 1;
+        case OP_TRUE:  *value = BOOL_VAL(true); return end - start == 1;
+        case OP_FALSE: *value = BOOL_VAL(false); return end - start == 1;
+        case OP_CONSTANT:
+            if (end - start != 2) return false;
+            *value = chunk->constants.values[chunk->code[start + 1]];
+            return true;
+        case OP_CONSTANT_LONG:
+            if (end - start != 4) return false;
+            *value = chunk->constants.values[chunk->code[start + 1] |
+                                             (chunk->code[start + 2] << 8) |
+                                             (chunk->code[start + 3] << 16)];
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Operations that would raise a type error are left alone so the VM
+// reports them at runtime with the right line.
+static bool fold_unary(TokenType operator_type, Value operand, Value* result) {
+    switch (operator_type) {
+        case TOKEN_BANG:
+            *result = BOOL_VAL(is_falsey(operand));
+            return true;
+        case TOKEN_MINUS:
+            if (!IS_NUMBER(operand)) return false;
+            *result = NUMBER_VAL(-AS_NUMBER(operand));
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool fold_binary(TokenType operator_type, Value a, Value b, Value* result) {
+    switch (operator_type) {
+        case TOKEN_EQUAL_EQUAL: *result = BOOL_VAL(values_equal(a, b)); return true;
+        case TOKEN_BANG_EQUAL:  *result = BOOL_VAL(!values_equal(a, b)); return true;
+        default:
+            break;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+
+    switch (operator_type) {
+        case TOKEN_GREATER:       *result = BOOL_VAL(x > y); return true;
+        case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true;
+        case TOKEN_LESS:          *result = BOOL_VAL(x < y); return true;
+        case TOKEN_LESS_EQUAL:    *result = BOOL_VAL(!(x > y)); return true;
+        case TOKEN_PLUS:  *result = NUMBER_VAL(x + y); return true;
+        case TOKEN_MINUS: *result = NUMBER_VAL(x - y); return true;
+        case TOKEN_STAR:  *result = NUMBER_VAL(x * y); return true;
+        case TOKEN_SLASH: *result = NUMBER_VAL(x / y); return true;
+        default:
+            return false;
+    }
 }
 
 static void end_compiler(Parser* parser) {
     emit_return(parser);
+
+    if (!parser->had_error) {
+        optimize_chunk(current_chunk(parser));
+    }
+
 #ifdef DEBUG_PRINT_CODE
     if (!parser->had_error) {
         dissasemble_chunk(current_chunk(parser), "code");
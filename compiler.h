@@ -2,6 +2,8 @@
 // Created by rodrigo on 17/1/21.
 //
 
+#include <stdio.h>
+
 #include "vm.h"
 #include "scanner.h"
 
@@ -11,11 +13,21 @@
 typedef struct {
     Token current;
     Token previous;
-    Scanner* scanner;
+    // Tokens come from tokens when the source was tokenized up front, and
+    // from scanner one at a time otherwise.
+    Scanner scanner;
+    TokenBuffer* tokens;
+    int next_token;
     bool had_error;
     bool panic_mode;
+    // Where compile errors are reported.
+    FILE* errors;
 
     Chunk* compiling_chunk;
+    // Offset of the last opcode emitted, used to spot constant operands.
+    int last_instruction;
+    // Whether operations on constants are evaluated at compile time.
+    bool fold;
 } Parser;
 
 typedef enum {
@@ -32,6 +44,16 @@ typedef enum {
     PREC_PRIMARY
 } Precedence;
 
-bool compile(const char* source, Chunk*);
+bool compile(const char* source, Chunk*, FILE* errors);
+
+// Like compile(), but tokenizes the whole source into a TokenBuffer before
+// parsing. Filling the buffer costs more than the parser saves by reading
+// it, so compile() streams; lox_bench reports both.
+bool compile_pretokenized(const char* source, Chunk*, FILE* errors);
+
+// Like compile(), but leaves every operation to the VM, even on constants.
+// Folding otherwise reduces any program that runs to a single constant, so
+// this is how tests get the backends to compute anything.
+bool compile_unfolded(const char* source, Chunk*, FILE* errors);
 
 #endif //LOX_COMPILER_H
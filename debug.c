@@ -9,8 +9,42 @@
 
 // Forward Declarations
 
+static const char* lookup_name(uint8_t opcode);
 static int simple_instruction(const char* name, int offset);
 static int constant_instruction(const char* name, Chunk*, int offset);
+static int constant_long_instruction(const char* name, Chunk*, int offset);
+
+static const char* const opcode_names[] = {
+    [OP_CONSTANT]          = "OP_CONSTANT",
+    [OP_CONSTANT_LONG]     = "OP_CONSTANT_LONG",
+    [OP_NIL]               = "OP_NIL",
+    [OP_TRUE]              = "OP_TRUE",
+    [OP_FALSE]             = "OP_FALSE",
+    [OP_EQUAL]             = "OP_EQUAL",
+    [OP_NOT_EQUAL]         = "OP_NOT_EQUAL",
+    [OP_GREATER]           = "OP_GREATER",
+    [OP_GREATER_EQUAL]     = "OP_GREATER_EQUAL",
+    [OP_LESS]              = "OP_LESS",
+    [OP_LESS_EQUAL]        = "OP_LESS_EQUAL",
+    [OP_ADD]               = "OP_ADD",
+    [OP_SUBTRACT]          = "OP_SUBTRACT",
+    [OP_MULTIPLY]          = "OP_MULTIPLY",
+    [OP_DIVIDE]            = "OP_DIVIDE",
+    [OP_NOT]               = "OP_NOT",
+    [OP_NEGATE]            = "OP_NEGATE",
+    [OP_RETURN]            = "OP_RETURN",
+    [OP_ADD_NUM]           = "OP_ADD_NUM",
+    [OP_SUBTRACT_NUM]      = "OP_SUBTRACT_NUM",
+    [OP_MULTIPLY_NUM]      = "OP_MULTIPLY_NUM",
+    [OP_DIVIDE_NUM]        = "OP_DIVIDE_NUM",
+    [OP_GREATER_NUM]       = "OP_GREATER_NUM",
+    [OP_GREATER_EQUAL_NUM] = "OP_GREATER_EQUAL_NUM",
+    [OP_LESS_NUM]          = "OP_LESS_NUM",
+    [OP_LESS_EQUAL_NUM]    = "OP_LESS_EQUAL_NUM",
+    [OP_EQUAL_NUM]         = "OP_EQUAL_NUM",
+    [OP_NOT_EQUAL_NUM]     = "OP_NOT_EQUAL_NUM",
+    [OP_NEGATE_NUM]        = "OP_NEGATE_NUM",
+};
 
 // Public interface
 
@@ -25,50 +59,41 @@ void dissasemble_chunk(Chunk* chunk, const char* name) {
 int dissasemble_instruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
 
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    int line = get_line(chunk, offset);
+    if (offset > 0 && line == get_line(chunk, offset - 1)) {
         printf("   | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
     }
 
+    // The table names every opcode; only the operands differ between them.
     uint8_t instruction = chunk->code[offset];
+    const char* name = lookup_name(instruction);
     switch (instruction) {
         case OP_CONSTANT:
-            return constant_instruction("OP_CONSTANT", chunk, offset);
-        case OP_NIL:
-            return simple_instruction("OP_NIL", offset);
-        case OP_TRUE:
-            return simple_instruction("OP_TRUE", offset);
-        case OP_FALSE:
-            return simple_instruction("OP_FALSE", offset);
-        case OP_EQUAL:
-            return simple_instruction("OP_EQUAL", offset);
-        case OP_GREATER:
-            return simple_instruction("OP_GREATER", offset);
-        case OP_LESS:
-            return simple_instruction("OP_LESS", offset);
-        case OP_ADD:
-            return simple_instruction("OP_ADD", offset);
-        case OP_SUBTRACT:
-            return simple_instruction("OP_SUBTRACT", offset);
-        case OP_MULTIPLY:
-            return simple_instruction("OP_MULTIPLY", offset);
-        case OP_DIVIDE:
-            return simple_instruction("OP_DIVIDE", offset);
-        case OP_NOT:
-            return simple_instruction("OP_NOT", offset);
-        case OP_NEGATE:
-            return simple_instruction("OP_NEGATE", offset);
-        case OP_RETURN:
-            return simple_instruction("OP_RETURN", offset);
+            return constant_instruction(name, chunk, offset);
+        case OP_CONSTANT_LONG:
+            return constant_long_instruction(name, chunk, offset);
         default:
+            if (name) return simple_instruction(name, offset);
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
 }
 
+const char* opcode_name(uint8_t opcode) {
+    const char* name = lookup_name(opcode);
+    return name ? name : "OP_UNKNOWN";
+}
+
 // Private
 
+// NULL for anything that is not an opcode.
+static const char* lookup_name(uint8_t opcode) {
+    if (opcode >= sizeof(opcode_names) / sizeof(opcode_names[0])) return NULL;
+    return opcode_names[opcode];
+}
+
 static int simple_instruction(const char* name, int offset) {
     printf("%s\n", name);
     return offset + 1;
@@ -80,4 +105,14 @@ static int constant_instruction(const char* name, Chunk* chunk, int offset) {
     print_value(chunk->constants.values[constant]);
     printf("'\n");
     return offset + 2;
+}
+
+static int constant_long_instruction(const char* name, Chunk* chunk, int offset) {
+    int constant = chunk->code[offset + 1] |
+                   (chunk->code[offset + 2] << 8) |
+                   (chunk->code[offset + 3] << 16);
+    printf("%-16s %4d '", name, constant);
+    print_value(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 4;
 }
\ No newline at end of file
@@ -9,5 +9,6 @@
 
 void dissasemble_chunk(Chunk*, const char* name);
 int dissasemble_instruction(Chunk*, int offset);
+const char* opcode_name(uint8_t opcode);
 
 #endif //LOX_DEBUG_H
@@ -0,0 +1,321 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emit_c.h"
+#include "memory.h"
+#include "number.h"
+#include "stack.h"
+
+// Stack slot i lives in the local n<i> while it holds a number, and in v<i>
+// otherwise. A local is declared where it is first assigned, which is always
+// at the top level of main(). The C compiler is left to fold and allocate
+// registers; the code only has to say what each instruction does.
+
+typedef enum {
+    TYPE_NIL,
+    TYPE_BOOL,
+    TYPE_NUMBER,
+} SlotType;
+
+// Which of a slot's locals have been declared.
+#define DECLARED_NUMBER 1
+#define DECLARED_VALUE  2
+
+typedef struct {
+    FILE* out;
+    SlotType* types;
+    uint8_t* declared;
+    int line; // Of the last instruction emitted.
+} Emitter;
+
+// Forward declarations
+
+static bool emit_body(Emitter*, Chunk*);
+static void emit_constant(Emitter*, int slot, Value);
+static void emit_number(Emitter*, double);
+static void assign_number(Emitter*, int slot);
+static void assign_value(Emitter*, int slot);
+static void emit_binary(Emitter*, OpCode, int slot);
+static void emit_equality(Emitter*, bool negated, int slot);
+static void emit_not(Emitter*, int slot);
+static void emit_comment_path(FILE*, const char* path);
+
+// Public
+
+bool emit_c(Chunk* chunk, const char* path, FILE* out) {
+    // The body goes to memory first, so nothing is written for a chunk that
+    // turns out to be malformed halfway through.
+    char* body = NULL;
+    size_t body_size = 0;
+    FILE* stream = open_memstream(&body, &body_size);
+    if (!stream) return false;
+
+    // Depth never exceeds the number of instructions.
+    Emitter emitter;
+    emitter.out = stream;
+    emitter.types = GROW_ARRAY(NULL, MEMORY_SITE_CODE, SlotType, NULL, 0, chunk->count + 1);
+    emitter.declared = GROW_ARRAY(NULL, MEMORY_SITE_CODE, uint8_t, NULL, 0, chunk->count + 1);
+    memset(emitter.declared, 0, (size_t)chunk->count + 1);
+    emitter.line = -1;
+
+    bool ok = emit_body(&emitter, chunk);
+    ok = fclose(stream) == 0 && ok;
+
+    if (ok) {
+        fputs("// Generated by lox --emit-c from ", out);
+        emit_comment_path(out, path);
+        fputs(".\n"
+              "//\n"
+              "// Build with any C99 compiler and link with the lox_rt library:\n"
+              "//\n"
+              "//   cc -O2 -ffp-contract=off -I<lox> this.c <lox build>/liblox_rt.a\n"
+              "//\n"
+              "// Without -ffp-contract=off a compiler may fuse a * b + c into one\n"
+              "// operation, which rounds once where the interpreter rounds twice.\n"
+              "\n"
+              "#include \"lox_rt.h\"\n"
+              "\n"
+              "int main(void) {\n", out);
+        fwrite(body, 1, body_size, out);
+        fputs("}\n", out);
+        ok = !ferror(out);
+    }
+
+    free(body);
+    FREE_ARRAY(NULL, MEMORY_SITE_CODE, SlotType, emitter.types, chunk->count + 1);
+    FREE_ARRAY(NULL, MEMORY_SITE_CODE, uint8_t, emitter.declared, chunk->count + 1);
+    return ok;
+}
+
+// Private
+
+// Like the JIT, stops after the first instruction that cannot complete:
+// nothing after it can run.
+static bool emit_body(Emitter* emitter, Chunk* chunk) {
+    FILE* out = emitter->out;
+    int depth = 0;
+
+    for (int offset = 0; offset < chunk->count;) {
+        int line = get_line(chunk, offset);
+        if (line != emitter->line) {
+            fprintf(out, "%s    // line %d\n", emitter->line < 0 ? "" : "\n", line);
+            emitter->line = line;
+        }
+
+        // A chunk that already ran may hold quickened instructions.
+        OpCode instruction = generic_opcode(chunk->code[offset]);
+        offset += 1;
+
+        int arity;
+        switch (instruction) {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+                arity = 0;
+                break;
+            case OP_NOT:
+            case OP_NEGATE:
+            case OP_RETURN:
+                arity = 1;
+                break;
+            case OP_EQUAL:
+            case OP_NOT_EQUAL:
+            case OP_GREATER:
+            case OP_GREATER_EQUAL:
+            case OP_LESS:
+            case OP_LESS_EQUAL:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+                arity = 2;
+                break;
+            default:
+                return false;
+        }
+        if (depth < arity) return false;
+
+        if (arity == 0 && depth == STACK_MAX) {
+            fprintf(out, "    return lox_rt_runtime_error(\"Stack overflow.\", %d);\n", line);
+            return true;
+        }
+
+        switch (instruction) {
+            case OP_CONSTANT:
+                emit_constant(emitter, depth, chunk->constants.values[chunk->code[offset]]);
+                offset += 1;
+                break;
+            case OP_CONSTANT_LONG: {
+                int constant = chunk->code[offset] |
+                               (chunk->code[offset + 1] << 8) |
+                               (chunk->code[offset + 2] << 16);
+                emit_constant(emitter, depth, chunk->constants.values[constant]);
+                offset += 3;
+                break;
+            }
+            case OP_NIL:   emit_constant(emitter, depth, NIL_VAL); break;
+            case OP_TRUE:  emit_constant(emitter, depth, BOOL_VAL(true)); break;
+            case OP_FALSE: emit_constant(emitter, depth, BOOL_VAL(false)); break;
+
+            case OP_EQUAL:     emit_equality(emitter, false, depth - 2); break;
+            case OP_NOT_EQUAL: emit_equality(emitter, true, depth - 2); break;
+            case OP_NOT:       emit_not(emitter, depth - 1); break;
+
+            case OP_NEGATE:
+                if (emitter->types[depth - 1] != TYPE_NUMBER) {
+                    fprintf(out, "    return lox_rt_runtime_error(\"Operand must be a number.\", %d);\n",
+                            line);
+                    return true;
+                }
+                assign_number(emitter, depth - 1);
+                fprintf(out, "-n%d;\n", depth - 1);
+                break;
+
+            case OP_RETURN:
+                if (emitter->types[depth - 1] == TYPE_NUMBER) {
+                    fprintf(out, "    return lox_rt_return(LOX_NUMBER_VALUE(n%d));\n", depth - 1);
+                } else {
+                    fprintf(out, "    return lox_rt_return(v%d);\n", depth - 1);
+                }
+                return offset == chunk->count;
+
+            default:
+                if (emitter->types[depth - 2] != TYPE_NUMBER ||
+                    emitter->types[depth - 1] != TYPE_NUMBER) {
+                    fprintf(out, "    return lox_rt_runtime_error(\"Operands must be numbers.\", %d);\n",
+                            line);
+                    return true;
+                }
+                emit_binary(emitter, instruction, depth - 2);
+                break;
+        }
+
+        depth += arity == 0 ? 1 : 1 - arity;
+    }
+
+    return false;
+}
+
+static void emit_constant(Emitter* emitter, int slot, Value value) {
+    if (IS_NUMBER(value)) {
+        assign_number(emitter, slot);
+        emit_number(emitter, AS_NUMBER(value));
+        emitter->types[slot] = TYPE_NUMBER;
+        return;
+    }
+
+    assign_value(emitter, slot);
+    if (IS_NIL(value)) {
+        fputs("LOX_NIL_VALUE;\n", emitter->out);
+        emitter->types[slot] = TYPE_NIL;
+    } else {
+        fprintf(emitter->out, "LOX_BOOL_VALUE(%s);\n", AS_BOOL(value) ? "true" : "false");
+        emitter->types[slot] = TYPE_BOOL;
+    }
+}
+
+// Hexadecimal literals are exact, whatever the compiler's decimal
+// conversion; the decimal form follows for whoever reads the code.
+static void emit_number(Emitter* emitter, double number) {
+    if (isnan(number)) {
+        fputs("NAN;\n", emitter->out);
+    } else if (isinf(number)) {
+        fputs(number < 0 ? "-INFINITY;\n" : "INFINITY;\n", emitter->out);
+    } else {
+        char text[NUMBER_BUFFER_SIZE];
+        format_number(number, text);
+        fprintf(emitter->out, "%a; // %s\n", number, text);
+    }
+}
+
+// Start the statement that assigns the slot's number or value local.
+
+static void assign_number(Emitter* emitter, int slot) {
+    bool declared = emitter->declared[slot] & DECLARED_NUMBER;
+    emitter->declared[slot] |= DECLARED_NUMBER;
+    fprintf(emitter->out, "    %sn%d = ", declared ? "" : "double ", slot);
+}
+
+static void assign_value(Emitter* emitter, int slot) {
+    bool declared = emitter->declared[slot] & DECLARED_VALUE;
+    emitter->declared[slot] |= DECLARED_VALUE;
+    fprintf(emitter->out, "    %sv%d = ", declared ? "" : "LoxValue ", slot);
+}
+
+// Arithmetic and comparisons of the numbers in slot and the one above it.
+// Lox defines a >= b as !(a < b) and a <= b as !(a > b), which is not what
+// the C operators do when a NaN is involved.
+static void emit_binary(Emitter* emitter, OpCode instruction, int slot) {
+    const char* format;
+    switch (instruction) {
+        case OP_GREATER:       format = "n%d > n%d"; break;
+        case OP_GREATER_EQUAL: format = "!(n%d < n%d)"; break;
+        case OP_LESS:          format = "n%d < n%d"; break;
+        case OP_LESS_EQUAL:    format = "!(n%d > n%d)"; break;
+        case OP_ADD:           format = "n%d + n%d"; break;
+        case OP_SUBTRACT:      format = "n%d - n%d"; break;
+        case OP_MULTIPLY:      format = "n%d * n%d"; break;
+        default:               format = "n%d / n%d"; break;
+    }
+
+    bool comparison = instruction >= OP_GREATER && instruction <= OP_LESS_EQUAL;
+    if (comparison) {
+        assign_value(emitter, slot);
+        fputs("LOX_BOOL_VALUE(", emitter->out);
+        emitter->types[slot] = TYPE_BOOL;
+    } else {
+        assign_number(emitter, slot);
+    }
+
+    fprintf(emitter->out, format, slot, slot + 1);
+    fputs(comparison ? ");\n" : ";\n", emitter->out);
+}
+
+// As in values_equal(): numbers compare as doubles, bools by value, and
+// values of different types are never equal.
+static void emit_equality(Emitter* emitter, bool negated, int slot) {
+    SlotType a = emitter->types[slot];
+    SlotType b = emitter->types[slot + 1];
+    const char* op = negated ? "!=" : "==";
+
+    assign_value(emitter, slot);
+    if (a != b) {
+        fprintf(emitter->out, "LOX_BOOL_VALUE(%s);\n", negated ? "true" : "false");
+    } else if (a == TYPE_NUMBER) {
+        fprintf(emitter->out, "LOX_BOOL_VALUE(n%d %s n%d);\n", slot, op, slot + 1);
+    } else if (a == TYPE_BOOL) {
+        fprintf(emitter->out, "LOX_BOOL_VALUE(v%d.as.boolean %s v%d.as.boolean);\n",
+                slot, op, slot + 1);
+    } else {
+        fprintf(emitter->out, "LOX_BOOL_VALUE(%s);\n", negated ? "false" : "true");
+    }
+    emitter->types[slot] = TYPE_BOOL;
+}
+
+// nil is falsey and every number truthy.
+static void emit_not(Emitter* emitter, int slot) {
+    SlotType type = emitter->types[slot];
+
+    assign_value(emitter, slot);
+    if (type == TYPE_BOOL) {
+        fprintf(emitter->out, "LOX_BOOL_VALUE(!v%d.as.boolean);\n", slot);
+    } else {
+        fprintf(emitter->out, "LOX_BOOL_VALUE(%s);\n", type == TYPE_NIL ? "true" : "false");
+    }
+    emitter->types[slot] = TYPE_BOOL;
+}
+
+// Control characters, which could end the comment early, are replaced.
+static void emit_comment_path(FILE* out, const char* path) {
+    for (const char* c = path; *c != '\0'; c += 1) {
+        fputc(*c >= ' ' && *c != 0x7f ? *c : '?', out);
+    }
+}
@@ -0,0 +1,25 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_EMIT_C_H
+#define LOX_EMIT_C_H
+
+#include <stdio.h>
+
+#include "chunk.h"
+
+// Writes the chunk out as a C translation unit whose main() does what
+// running the chunk does: it prints the same result, or reports the same
+// runtime error, and exits with the same status as lox. The unit includes
+// lox_rt.h and links against the lox_rt library.
+//
+// Every operand starts out as a constant, so the type in every stack slot is
+// known while emitting. Number slots become double locals and the others
+// LoxValues; a type error becomes a direct call to the runtime's report.
+//
+// path only goes into a comment. Fails when the chunk does not have the
+// shape the compiler produces.
+bool emit_c(Chunk*, const char* path, FILE* out);
+
+#endif //LOX_EMIT_C_H
@@ -0,0 +1,618 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include "jit.h"
+
+#ifdef JIT
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "stack.h"
+
+// A template compiler: every instruction becomes a short, fixed sequence of
+// machine code, in bytecode order. Straight-line code sees the same depth on
+// every run, so each stack slot gets a fixed home: one of xmm2 to xmm15 for
+// the bottom slots, and its place on the VM stack above them.
+//
+// Every operand in a chunk starts out as a constant, so the type in every
+// slot is known while compiling. That is where the guards are checked: an
+// instruction whose operands would fail the interpreter's type check
+// compiles to an exit, which writes the stack out to memory as the
+// interpreter keeps it and returns to let it run that instruction. Nothing
+// after an exit can run, so compiling stops there.
+//
+// Constants are not loaded until something needs them, and numbers are then
+// read straight from a pool after the code. The generated function is
+// bool f(Value* stack, Value* result), called with the System V convention.
+// Throughout it, rdi holds the stack base, rsi where the result goes, and
+// r10 FALSE_VAL, plus one of which is TRUE_VAL. rax, rcx, rdx, xmm0 and xmm1
+// are scratch.
+
+struct JitCode {
+    void* code;
+    size_t size; // Of the mapping.
+    JitExit exit;
+};
+
+typedef bool (*JitFunction)(Value* stack, Value* result);
+
+// Registers, numbered as in instruction encodings.
+#define RAX  0
+#define RDX  2
+#define XMM0 0
+#define XMM1 1
+
+// Slots kept in registers, from xmm2 up.
+#define XMM_HOMES 14
+
+// The pool starts with a 16-byte mask for xorpd, then the chunk's constants.
+#define POOL_SIGN_MASK 0
+#define POOL_CONSTANTS 2
+
+typedef enum {
+    SLOT_CONSTANT, // Not loaded yet.
+    SLOT_HOME,     // In its register or stack slot.
+} SlotKind;
+
+typedef enum {
+    TYPE_NIL,
+    TYPE_BOOL,
+    TYPE_NUMBER,
+} SlotType;
+
+typedef struct {
+    SlotKind kind;
+    SlotType type;
+    Value value; // For a constant.
+    int pool;    // For a constant number, its pool entry.
+} Slot;
+
+// An operand of an SSE instruction.
+typedef enum {
+    LOCATION_REGISTER,
+    LOCATION_STACK,
+    LOCATION_POOL,
+} LocationKind;
+
+typedef struct {
+    LocationKind kind;
+    int number; // Register, stack slot or pool entry.
+} Location;
+
+// A RIP-relative displacement, to be pointed at its pool entry.
+typedef struct {
+    int position;
+    int pool;
+} Patch;
+
+typedef struct {
+    uint8_t* code;
+    int count;
+    int capacity;
+
+    Patch* patches;
+    int patch_count;
+    int patch_capacity;
+
+    // The stack as it will be when the code gets to the current instruction.
+    Slot* slots;
+    int slot_capacity;
+
+    // Where the interpreter takes over, if the code ends in an exit.
+    JitExit exit;
+} Assembler;
+
+#define EMIT(assembler, ...) \
+    emit_bytes(assembler, (const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+// Forward declarations
+
+static void init_assembler(Assembler*, int slot_capacity);
+static void free_assembler(Assembler*);
+static void emit_bytes(Assembler*, const uint8_t* bytes, int count);
+static void emit_u32(Assembler*, uint32_t);
+static void emit_u64(Assembler*, uint64_t);
+static void emit_sse(Assembler*, uint8_t prefix, bool wide, uint8_t opcode, int reg, Location);
+static void emit_stack_move(Assembler*, uint8_t opcode, int reg, int slot);
+
+static bool assemble(Assembler*, Chunk*);
+static bool are_numbers(Assembler*, int depth, int count);
+static void push_constant(Assembler*, Chunk*, int slot, int constant);
+static Location home(int slot);
+static Location locate(Assembler*, int slot);
+static int number_register(Assembler*, int slot, int scratch);
+static void load_value(Assembler*, int slot, int reg);
+static void store_value(Assembler*, int slot);
+static int number_target(Assembler*, int slot);
+static void finish_number(Assembler*, int slot, int reg);
+static void arithmetic(Assembler*, uint8_t opcode, int depth);
+static void negate(Assembler*, int depth);
+static void comparison(Assembler*, bool swapped, uint8_t setcc, int depth);
+static void equality(Assembler*, bool negated, int depth);
+static void invert(Assembler*, int depth);
+static void finish_bool(Assembler*, int slot);
+static void set_constant(Assembler*, int slot, Value, int pool);
+static void exit_to_interpreter(Assembler*, int offset, int depth);
+
+static JitCode* map_code(Assembler*, Chunk*);
+
+// Public
+
+JitCode* compile_jit(Chunk* chunk) {
+    if (chunk->count > JIT_CHUNK_MAX) return NULL;
+
+    // Depth never exceeds the number of instructions.
+    Assembler assembler;
+    init_assembler(&assembler, chunk->count + 1);
+
+    JitCode* jit = assemble(&assembler, chunk) ? map_code(&assembler, chunk) : NULL;
+
+    free_assembler(&assembler);
+    return jit;
+}
+
+void free_jit(JitCode* jit) {
+    if (!jit) return;
+
+    munmap(jit->code, jit->size);
+    free(jit);
+}
+
+bool run_jit(JitCode* jit, Value* stack, Value* result, JitExit* resume) {
+    if (((JitFunction)jit->code)(stack, result)) return true;
+
+    *resume = jit->exit;
+    return false;
+}
+
+// Private
+
+static void init_assembler(Assembler* assembler, int slot_capacity) {
+    assembler->code = NULL;
+    assembler->count = 0;
+    assembler->capacity = 0;
+    assembler->patches = NULL;
+    assembler->patch_count = 0;
+    assembler->patch_capacity = 0;
+    assembler->slots = GROW_ARRAY(NULL, MEMORY_SITE_JIT, Slot, NULL, 0, slot_capacity);
+    assembler->slot_capacity = slot_capacity;
+    assembler->exit.offset = 0;
+    assembler->exit.depth = 0;
+}
+
+static void free_assembler(Assembler* assembler) {
+    FREE_ARRAY(NULL, MEMORY_SITE_JIT, uint8_t, assembler->code, assembler->capacity);
+    FREE_ARRAY(NULL, MEMORY_SITE_JIT, Patch, assembler->patches, assembler->patch_capacity);
+    FREE_ARRAY(NULL, MEMORY_SITE_JIT, Slot, assembler->slots, assembler->slot_capacity);
+}
+
+static void emit_bytes(Assembler* assembler, const uint8_t* bytes, int count) {
+    if (assembler->capacity < assembler->count + count) {
+        int old_capacity = assembler->capacity;
+        while (assembler->capacity < assembler->count + count) {
+            assembler->capacity = GROW_CAPACITY(assembler->capacity);
+        }
+        assembler->code = GROW_ARRAY(NULL, MEMORY_SITE_JIT, uint8_t, assembler->code,
+                                     old_capacity, assembler->capacity);
+    }
+
+    memcpy(assembler->code + assembler->count, bytes, (size_t)count);
+    assembler->count += count;
+}
+
+static void emit_u32(Assembler* assembler, uint32_t value) {
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i += 1) bytes[i] = (uint8_t)(value >> (8 * i));
+    emit_bytes(assembler, bytes, 4);
+}
+
+static void emit_u64(Assembler* assembler, uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i += 1) bytes[i] = (uint8_t)(value >> (8 * i));
+    emit_bytes(assembler, bytes, 8);
+}
+
+// prefix 0F opcode with reg in the ModRM reg field and the location in r/m.
+// wide sets REX.W, for moves between xmm and general purpose registers.
+static void emit_sse(Assembler* assembler, uint8_t prefix, bool wide, uint8_t opcode, int reg,
+                     Location location) {
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | (reg >= 8 ? 0x04 : 0) |
+                  (location.kind == LOCATION_REGISTER && location.number >= 8 ? 0x01 : 0);
+
+    EMIT(assembler, prefix);
+    if (rex != 0x40) EMIT(assembler, rex);
+    EMIT(assembler, 0x0f, opcode);
+
+    switch (location.kind) {
+        case LOCATION_REGISTER:
+            EMIT(assembler, (uint8_t)(0xc0 | (reg & 7) << 3 | (location.number & 7)));
+            break;
+        case LOCATION_STACK: // [rdi + disp32]
+            EMIT(assembler, (uint8_t)(0x87 | (reg & 7) << 3));
+            emit_u32(assembler, (uint32_t)location.number * sizeof(Value));
+            break;
+        case LOCATION_POOL: { // [rip + disp32], fixed up by map_code()
+            EMIT(assembler, (uint8_t)(0x05 | (reg & 7) << 3));
+
+            if (assembler->patch_capacity < assembler->patch_count + 1) {
+                int old_capacity = assembler->patch_capacity;
+                assembler->patch_capacity = GROW_CAPACITY(old_capacity);
+                assembler->patches = GROW_ARRAY(NULL, MEMORY_SITE_JIT, Patch, assembler->patches,
+                                                old_capacity, assembler->patch_capacity);
+            }
+
+            assembler->patches[assembler->patch_count].position = assembler->count;
+            assembler->patches[assembler->patch_count].pool = location.number;
+            assembler->patch_count += 1;
+            emit_u32(assembler, 0);
+            break;
+        }
+    }
+}
+
+// mov reg, [rdi + slot * 8] for opcode 8B, mov [rdi + slot * 8], reg for 89.
+static void emit_stack_move(Assembler* assembler, uint8_t opcode, int reg, int slot) {
+    EMIT(assembler, 0x48, opcode, (uint8_t)(0x87 | reg << 3));
+    emit_u32(assembler, (uint32_t)slot * sizeof(Value));
+}
+
+// Fails on anything the compiler would not have produced, like the register
+// translation does, and on chunks deep enough to overflow the VM stack, which
+// are left for the interpreter to report.
+static bool assemble(Assembler* assembler, Chunk* chunk) {
+    EMIT(assembler, 0x49, 0xba); // mov r10, FALSE_VAL
+    emit_u64(assembler, FALSE_VAL);
+
+    int depth = 0;
+
+    for (int offset = 0; offset < chunk->count;) {
+        int start = offset;
+        // A chunk that already ran may hold quickened instructions.
+        OpCode instruction = generic_opcode(chunk->code[offset]);
+        offset += 1;
+
+        int arity = 2;
+        bool numbers = false;
+        switch (instruction) {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+                arity = 0;
+                break;
+            case OP_NOT:
+            case OP_RETURN:
+                arity = 1;
+                break;
+            case OP_NEGATE:
+                arity = 1;
+                numbers = true;
+                break;
+            case OP_EQUAL:
+            case OP_NOT_EQUAL:
+                break;
+            case OP_GREATER:
+            case OP_GREATER_EQUAL:
+            case OP_LESS:
+            case OP_LESS_EQUAL:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+                numbers = true;
+                break;
+            default:
+                return false;
+        }
+
+        if (depth < arity || (arity == 0 && depth == STACK_MAX)) return false;
+
+        if (numbers && !are_numbers(assembler, depth, arity)) {
+            exit_to_interpreter(assembler, start, depth);
+            return true;
+        }
+
+        switch (instruction) {
+            case OP_CONSTANT:
+                push_constant(assembler, chunk, depth, chunk->code[offset]);
+                offset += 1;
+                break;
+            case OP_CONSTANT_LONG:
+                push_constant(assembler, chunk, depth, chunk->code[offset] |
+                                                       (chunk->code[offset + 1] << 8) |
+                                                       (chunk->code[offset + 2] << 16));
+                offset += 3;
+                break;
+            case OP_NIL:   set_constant(assembler, depth, NIL_VAL, -1); break;
+            case OP_TRUE:  set_constant(assembler, depth, TRUE_VAL, -1); break;
+            case OP_FALSE: set_constant(assembler, depth, FALSE_VAL, -1); break;
+
+            case OP_EQUAL:     equality(assembler, false, depth); break;
+            case OP_NOT_EQUAL: equality(assembler, true, depth); break;
+
+            // seta is false and setbe true when either operand is a NaN, which
+            // gives Lox's a >= b as !(a < b) and a <= b as !(a > b).
+            case OP_GREATER:       comparison(assembler, false, 0x97, depth); break;
+            case OP_GREATER_EQUAL: comparison(assembler, true, 0x96, depth); break;
+            case OP_LESS:          comparison(assembler, true, 0x97, depth); break;
+            case OP_LESS_EQUAL:    comparison(assembler, false, 0x96, depth); break;
+
+            case OP_ADD:      arithmetic(assembler, 0x58, depth); break;
+            case OP_MULTIPLY: arithmetic(assembler, 0x59, depth); break;
+            case OP_SUBTRACT: arithmetic(assembler, 0x5c, depth); break;
+            case OP_DIVIDE:   arithmetic(assembler, 0x5e, depth); break;
+
+            case OP_NOT:    invert(assembler, depth); break;
+            case OP_NEGATE: negate(assembler, depth); break;
+
+            case OP_RETURN:
+                load_value(assembler, depth - 1, RAX);
+                EMIT(assembler, 0x48, 0x89, 0x06,             // mov [rsi], rax
+                                0xb8, 0x01, 0x00, 0x00, 0x00, // mov eax, 1
+                                0xc3);                        // ret
+                return offset == chunk->count;
+
+            default:
+                return false;
+        }
+
+        depth += arity == 0 ? 1 : 1 - arity;
+    }
+
+    return false;
+}
+
+static bool are_numbers(Assembler* assembler, int depth, int count) {
+    for (int slot = depth - count; slot < depth; slot += 1) {
+        if (assembler->slots[slot].type != TYPE_NUMBER) return false;
+    }
+    return true;
+}
+
+static void push_constant(Assembler* assembler, Chunk* chunk, int slot, int constant) {
+    set_constant(assembler, slot, chunk->constants.values[constant], POOL_CONSTANTS + constant);
+}
+
+static Location home(int slot) {
+    if (slot < XMM_HOMES) return (Location){ LOCATION_REGISTER, XMM1 + 1 + slot };
+    return (Location){ LOCATION_STACK, slot };
+}
+
+// Where a number in the slot can be read from.
+static Location locate(Assembler* assembler, int slot) {
+    Slot* entry = &assembler->slots[slot];
+    if (entry->kind == SLOT_CONSTANT) return (Location){ LOCATION_POOL, entry->pool };
+    return home(slot);
+}
+
+// The xmm register holding the number in the slot, loaded into scratch
+// unless it is already in one.
+static int number_register(Assembler* assembler, int slot, int scratch) {
+    Location location = locate(assembler, slot);
+    if (location.kind == LOCATION_REGISTER) return location.number;
+
+    emit_sse(assembler, 0xf2, false, 0x10, scratch, location); // movsd scratch, location
+    return scratch;
+}
+
+// Loads the bits of any value into rax or rdx.
+static void load_value(Assembler* assembler, int slot, int reg) {
+    Slot* entry = &assembler->slots[slot];
+    Location location = home(slot);
+
+    if (entry->kind == SLOT_CONSTANT) {
+        EMIT(assembler, 0x48, (uint8_t)(0xb8 + reg)); // mov reg, value
+        emit_u64(assembler, entry->value);
+    } else if (location.kind == LOCATION_REGISTER) {
+        emit_sse(assembler, 0x66, true, 0x7e, location.number,
+                 (Location){ LOCATION_REGISTER, reg }); // movq reg, xmm
+    } else {
+        emit_stack_move(assembler, 0x8b, reg, slot);
+    }
+}
+
+// Stores the bits in rax as the slot's value.
+static void store_value(Assembler* assembler, int slot) {
+    Location location = home(slot);
+
+    if (location.kind == LOCATION_REGISTER) {
+        emit_sse(assembler, 0x66, true, 0x6e, location.number,
+                 (Location){ LOCATION_REGISTER, RAX }); // movq xmm, rax
+    } else {
+        emit_stack_move(assembler, 0x89, RAX, slot);
+    }
+
+    assembler->slots[slot].kind = SLOT_HOME;
+}
+
+// Computes into the left operand's register when it has one, or xmm0.
+static int number_target(Assembler* assembler, int slot) {
+    Location target = home(slot);
+    int reg = target.kind == LOCATION_REGISTER ? target.number : XMM0;
+
+    if (assembler->slots[slot].kind == SLOT_CONSTANT || target.kind == LOCATION_STACK) {
+        emit_sse(assembler, 0xf2, false, 0x10, reg, locate(assembler, slot)); // movsd reg, a
+    }
+    return reg;
+}
+
+static void finish_number(Assembler* assembler, int slot, int reg) {
+    if (reg == XMM0) emit_sse(assembler, 0xf2, false, 0x11, XMM0, home(slot)); // movsd a, xmm0
+    assembler->slots[slot].kind = SLOT_HOME;
+    assembler->slots[slot].type = TYPE_NUMBER;
+}
+
+// opcode is the second byte of addsd, mulsd, subsd or divsd.
+static void arithmetic(Assembler* assembler, uint8_t opcode, int depth) {
+    int reg = number_target(assembler, depth - 2);
+    emit_sse(assembler, 0xf2, false, opcode, reg, locate(assembler, depth - 1)); // op reg, b
+    finish_number(assembler, depth - 2, reg);
+}
+
+static void negate(Assembler* assembler, int depth) {
+    int reg = number_target(assembler, depth - 1);
+    emit_sse(assembler, 0x66, false, 0x57, reg,
+             (Location){ LOCATION_POOL, POOL_SIGN_MASK }); // xorpd reg, sign
+    finish_number(assembler, depth - 1, reg);
+}
+
+// Compares a to b, or b to a when swapped, and keeps what setcc tests.
+static void comparison(Assembler* assembler, bool swapped, uint8_t setcc, int depth) {
+    int left = swapped ? depth - 1 : depth - 2;
+    int right = swapped ? depth - 2 : depth - 1;
+
+    int reg = number_register(assembler, left, XMM0);
+    emit_sse(assembler, 0x66, false, 0x2e, reg, locate(assembler, right)); // ucomisd
+    EMIT(assembler, 0x0f, setcc, 0xc0);                                     // setcc al
+    finish_bool(assembler, depth - 2);
+}
+
+// As in values_equal(): numbers compare as doubles, and anything else bit for
+// bit, which makes values of different types unequal.
+static void equality(Assembler* assembler, bool negated, int depth) {
+    Slot* a = &assembler->slots[depth - 2];
+    Slot* b = &assembler->slots[depth - 1];
+
+    if (a->type != b->type) {
+        set_constant(assembler, depth - 2, negated ? TRUE_VAL : FALSE_VAL, -1);
+        return;
+    }
+
+    if (a->type == TYPE_NUMBER) {
+        int reg = number_register(assembler, depth - 2, XMM0);
+        emit_sse(assembler, 0x66, false, 0x2e, reg, locate(assembler, depth - 1)); // ucomisd
+        EMIT(assembler, 0x0f, 0x94, 0xc0,  // sete al
+                        0x0f, 0x9b, 0xc1,  // setnp cl
+                        0x20, 0xc8);       // and al, cl
+    } else {
+        load_value(assembler, depth - 2, RAX);
+        load_value(assembler, depth - 1, RDX);
+        EMIT(assembler, 0x48, 0x39, 0xd0,  // cmp rax, rdx
+                        0x0f, 0x94, 0xc0); // sete al
+    }
+
+    if (negated) EMIT(assembler, 0x34, 0x01); // xor al, 1
+    finish_bool(assembler, depth - 2);
+}
+
+// nil is falsey and numbers are truthy whatever their value. A bool only
+// differs from its opposite in the low bit.
+static void invert(Assembler* assembler, int depth) {
+    Slot* a = &assembler->slots[depth - 1];
+
+    if (a->type != TYPE_BOOL) {
+        set_constant(assembler, depth - 1, a->type == TYPE_NIL ? TRUE_VAL : FALSE_VAL, -1);
+        return;
+    }
+
+    load_value(assembler, depth - 1, RAX);
+    EMIT(assembler, 0x48, 0x83, 0xf0, 0x01); // xor rax, 1
+    store_value(assembler, depth - 1);
+}
+
+// Stores the bool in al as a Value.
+static void finish_bool(Assembler* assembler, int slot) {
+    EMIT(assembler, 0x0f, 0xb6, 0xc0,  // movzx eax, al
+                    0x4c, 0x01, 0xd0); // add rax, r10
+    store_value(assembler, slot);
+    assembler->slots[slot].type = TYPE_BOOL;
+}
+
+static void set_constant(Assembler* assembler, int slot, Value value, int pool) {
+    Slot* entry = &assembler->slots[slot];
+    entry->kind = SLOT_CONSTANT;
+    entry->type = IS_NUMBER(value) ? TYPE_NUMBER : IS_NIL(value) ? TYPE_NIL : TYPE_BOOL;
+    entry->value = value;
+    entry->pool = pool;
+}
+
+// Writes every slot out to the VM stack and returns false, to resume the
+// interpreter at offset with depth values on the stack.
+static void exit_to_interpreter(Assembler* assembler, int offset, int depth) {
+    for (int slot = 0; slot < depth; slot += 1) {
+        Location location = home(slot);
+
+        if (assembler->slots[slot].kind == SLOT_CONSTANT) {
+            load_value(assembler, slot, RAX);
+            emit_stack_move(assembler, 0x89, RAX, slot);
+        } else if (location.kind == LOCATION_REGISTER) {
+            emit_sse(assembler, 0xf2, false, 0x11, location.number,
+                     (Location){ LOCATION_STACK, slot }); // movsd [rdi + slot * 8], xmm
+        }
+    }
+
+    EMIT(assembler, 0x31, 0xc0, // xor eax, eax
+                    0xc3);      // ret
+
+    assembler->exit.offset = offset;
+    assembler->exit.depth = depth;
+}
+
+// Appends the pool, points every reference at it, and copies the code into
+// a mapping that is never writable and executable at once.
+static JitCode* map_code(Assembler* assembler, Chunk* chunk) {
+    while (assembler->count % 16 != 0) EMIT(assembler, 0xcc); // int3
+
+    int pool = assembler->count;
+    emit_u64(assembler, (uint64_t)1 << 63);
+    emit_u64(assembler, 0);
+    for (int i = 0; i < chunk->constants.count; i += 1) {
+        emit_u64(assembler, chunk->constants.values[i]);
+    }
+
+    for (int i = 0; i < assembler->patch_count; i += 1) {
+        Patch* patch = &assembler->patches[i];
+        int entry = pool + patch->pool * (int)sizeof(Value);
+        uint32_t displacement = (uint32_t)(entry - (patch->position + 4));
+        for (int j = 0; j < 4; j += 1) {
+            assembler->code[patch->position + j] = (uint8_t)(displacement >> (8 * j));
+        }
+    }
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = ((size_t)assembler->count + page_size - 1) & ~(page_size - 1);
+
+    void* code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) return NULL;
+
+    memcpy(code, assembler->code, (size_t)assembler->count);
+    JitCode* jit = malloc(sizeof(JitCode));
+    if (!jit || mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        free(jit);
+        munmap(code, size);
+        return NULL;
+    }
+
+    jit->code = code;
+    jit->size = size;
+    jit->exit = assembler->exit;
+    return jit;
+}
+
+#else
+
+// Without a JIT every chunk is interpreted, and there is never code to run.
+
+JitCode* compile_jit(Chunk* chunk) {
+    (void)chunk;
+    return NULL;
+}
+
+void free_jit(JitCode* jit) {
+    (void)jit;
+}
+
+bool run_jit(JitCode* jit, Value* stack, Value* result, JitExit* resume) {
+    (void)jit;
+    (void)stack;
+    (void)result;
+    (void)resume;
+    return false;
+}
+
+#endif
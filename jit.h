@@ -0,0 +1,44 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_JIT_H
+#define LOX_JIT_H
+
+#include "chunk.h"
+
+// Runs of a chunk through interpret_chunk() before it is compiled to machine
+// code. Compiling costs about as much as a few interpreted runs, so only
+// chunks that keep coming back are worth it.
+//
+// Only a chunk that is run again and again gets there: a program run with
+// lox_run(), or a chunk an embedder passes to interpret_chunk() repeatedly.
+// interpret() compiles a fresh chunk on every call, so nothing the lox
+// executable runs (a script, REPL line or batch expression) is ever
+// compiled to machine code.
+#define JIT_THRESHOLD 16
+
+// Bytecode size past which a chunk stays interpreted; it keeps every pool
+// and stack offset in the generated code within 32 bits.
+#define JIT_CHUNK_MAX (1 << 24)
+
+// Where the interpreter picks up from native code: the instruction at
+// offset, with depth values on the stack.
+typedef struct {
+    int offset;
+    int depth;
+} JitExit;
+
+// Compiles the chunk to native code, or returns NULL when this build has no
+// JIT (see common.h), the chunk does not have the shape the compiler
+// produces, or the code cannot be mapped executable.
+JitCode* compile_jit(Chunk*);
+void free_jit(JitCode*);
+
+// Runs the code on stack slots from stack up. Returns true when it reached
+// OP_RETURN, with the returned value in result. Returns false at an
+// instruction whose operands fail its type check, with the stack left
+// exactly as the interpreter would have it there, for it to report the error.
+bool run_jit(JitCode*, Value* stack, Value* result, JitExit* resume);
+
+#endif //LOX_JIT_H
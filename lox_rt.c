@@ -0,0 +1,34 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lox_rt.h"
+#include "number.h"
+
+// Matches lox's own exit statuses.
+#define EXIT_RUNTIME_ERROR 70
+
+// Public
+
+int lox_rt_return(LoxValue result) {
+    char text[NUMBER_BUFFER_SIZE];
+
+    switch (result.type) {
+        case LOX_NIL:  puts("nil"); break;
+        case LOX_BOOL: puts(result.as.boolean ? "true" : "false"); break;
+        case LOX_NUMBER:
+            format_number(result.as.number, text);
+            puts(text);
+            break;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int lox_rt_runtime_error(const char* message, int line) {
+    fprintf(stderr, "%s\n[line %d] in script\n", message, line);
+    return EXIT_RUNTIME_ERROR;
+}
@@ -0,0 +1,44 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_RT_H
+#define LOX_RT_H
+
+#include <math.h>
+#include <stdbool.h>
+
+// The runtime that programs written by lox --emit-c link against, see
+// emit_c.h. It depends on nothing else of the interpreter but number.c, so
+// the same text is printed for the same result.
+
+// Generated code keeps numbers in plain doubles. Everything else is held in
+// this, the C counterpart of the interpreter's Value.
+typedef enum {
+    LOX_NIL,
+    LOX_BOOL,
+    LOX_NUMBER,
+} LoxType;
+
+typedef struct {
+    LoxType type;
+    union {
+        bool boolean;
+        double number;
+    } as;
+} LoxValue;
+
+#define LOX_NIL_VALUE         ((LoxValue){ LOX_NIL, { .number = 0 } })
+#define LOX_BOOL_VALUE(b)     ((LoxValue){ LOX_BOOL, { .boolean = (b) } })
+#define LOX_NUMBER_VALUE(n)   ((LoxValue){ LOX_NUMBER, { .number = (n) } })
+
+// Each of these ends the program: the return value is its exit status, the
+// same one lox exits with.
+
+// Prints the result on stdout, as lox does.
+int lox_rt_return(LoxValue result);
+
+// Reports an error on stderr as the VM's runtime_error() does.
+int lox_rt_runtime_error(const char* message, int line);
+
+#endif //LOX_RT_H
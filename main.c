@@ -1,8 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include "batch.h"
+#include "cache.h"
 #include "chunk.h"
+#include "compiler.h"
+#include "emit_c.h"
+#include "profile.h"
+#include "source.h"
+#include "trace.h"
 #include "vm.h"
 
 #define EXIT_BAD_ARGUMENT_COUNT 64
@@ -10,81 +19,316 @@
 #define EXIT_RUNTIME_ERROR 70
 #define EXIT_COULD_NOT_READ_FILE 74
 
+typedef struct {
+    const char* path;
+    bool mem_stats;
+    bool profile;
+    bool registers;
+    bool batch;                    // Expressions one per line, from path or stdin.
+    int jobs;                      // Worker threads for batch mode.
+    bool emit_c;                   // Print the script as C instead of running it.
+    bool no_fold;                  // Compile without constant folding, bypassing the cache.
+    const char* trace_path;        // Record the run into this file.
+    const char* decode_trace_path; // Print this trace instead of running.
+} Options;
+
 // Forward declarations
+static void parse_options(Options*, int argc, const char* argv[]);
+static void usage(void);
 static void repl(VM*);
-static void run_file(VM*, const char* path);
+static int run_file(VM*, const Options*);
+static int run_batch_input(VM*, const Options*);
+static int emit_file(VM*, const Options*);
+static bool load_chunk(VM*, const Options*, Source*, uint64_t source_hash, Chunk*);
 
 // Main
 
 int main(int argc, const char* argv[]) {
+    Options options;
+    parse_options(&options, argc, argv);
+
     VM vm;
     init_vm(&vm);
+    vm.use_registers = options.registers;
 
-    if (argc == 1) {
-        repl(&vm);
-    } else if (argc == 2) {
-        run_file(&vm, argv[1]);
+    int status = EXIT_SUCCESS;
+    if (options.batch) {
+        status = run_batch_input(&vm, &options);
+    } else if (options.emit_c) {
+        status = emit_file(&vm, &options);
+    } else if (options.path) {
+        status = run_file(&vm, &options);
     } else {
-        fprintf(stderr, "Usage: lox [path]\n");
-        exit(EXIT_BAD_ARGUMENT_COUNT);
+        repl(&vm);
+    }
+
+    flush_output(&vm.output);
+    if (options.mem_stats) {
+        print_memory_stats(stderr, get_memory_stats(&vm));
+
+        MemoryStats heap;
+        get_heap_memory_stats(&heap);
+        fprintf(stderr, "\noutside the arena:\n");
+        print_memory_stats(stderr, &heap);
     }
 
     free_vm(&vm);
 
-    return EXIT_SUCCESS;
+    return status;
+}
+
+static void parse_options(Options* options, int argc, const char* argv[]) {
+    options->path = NULL;
+    options->mem_stats = false;
+    options->profile = false;
+    options->registers = false;
+    options->batch = false;
+    options->jobs = 1;
+    options->emit_c = false;
+    options->no_fold = false;
+    options->trace_path = NULL;
+    options->decode_trace_path = NULL;
+
+    for (int i = 1; i < argc; i += 1) {
+        const char* argument = argv[i];
+
+        if (strcmp(argument, "--mem-stats") == 0) {
+            options->mem_stats = true;
+        } else if (strcmp(argument, "--profile") == 0) {
+            options->profile = true;
+        } else if (strcmp(argument, "--registers") == 0) {
+            options->registers = true;
+        } else if (strcmp(argument, "--batch") == 0) {
+            options->batch = true;
+        } else if (strcmp(argument, "--emit-c") == 0) {
+            options->emit_c = true;
+        } else if (strcmp(argument, "--no-fold") == 0) {
+            options->no_fold = true;
+        } else if (strcmp(argument, "--jobs") == 0 && i + 1 < argc) {
+            i += 1;
+            // Zero means one per online CPU.
+            options->jobs = atoi(argv[i]);
+            if (options->jobs == 0) options->jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            if (options->jobs < 1) usage();
+        } else if (strcmp(argument, "--trace") == 0 && i + 1 < argc) {
+            i += 1;
+            options->trace_path = argv[i];
+        } else if (strcmp(argument, "--decode-trace") == 0 && i + 1 < argc) {
+            i += 1;
+            options->decode_trace_path = argv[i];
+        } else if (strncmp(argument, "--", 2) != 0 && !options->path) {
+            options->path = argument;
+        } else {
+            usage();
+        }
+    }
+
+    // Traces and profiles are tied to one chunk, so they all need a script.
+    bool per_chunk = options->profile || options->trace_path || options->decode_trace_path;
+    if (per_chunk && !options->path) usage();
+    if (options->profile && options->trace_path) usage();
+    if (per_chunk && options->batch) usage();
+
+    // Only scripts are compiled by load_chunk().
+    if (options->no_fold && (!options->path || options->batch)) usage();
+
+    // Folded, any script that runs is a single constant with nothing in it
+    // to profile.
+    if (options->profile) options->no_fold = true;
+
+    // Emitting C runs nothing, so nothing about running applies.
+    if (options->emit_c && (!options->path || per_chunk || options->batch ||
+                            options->registers || options->jobs > 1)) {
+        usage();
+    }
+
+    // Workers have VMs of their own, whose memory is not counted.
+    if (options->jobs > 1 && (!options->batch || options->mem_stats)) usage();
+
+    // Only the stack loop can be traced or profiled.
+    if (options->registers && (options->profile || options->trace_path)) usage();
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: lox [--mem-stats] [--registers] [path]\n"
+                    "       lox [--mem-stats] [--registers] --no-fold <path>\n"
+                    "       lox [--mem-stats] [--registers] --batch [path]\n"
+                    "       lox [--registers] --jobs <n> --batch [path]\n"
+                    "       lox [--mem-stats] [--no-fold] --trace <trace> <path>\n"
+                    "       lox [--mem-stats] [--no-fold] --profile <path>\n"
+                    "       lox [--no-fold] --decode-trace <trace> <path>\n"
+                    "       lox [--mem-stats] [--no-fold] --emit-c <path>\n");
+    exit(EXIT_BAD_ARGUMENT_COUNT);
 }
 
 static void repl(VM* vm) {
     char line[1024];
     while (true) {
-        printf("> ");
+        output_bytes(&vm->output, "> ", 2);
+        flush_output(&vm->output);
 
         if (!fgets(line, sizeof(line), stdin)) {
-            printf("\n");
+            output_char(&vm->output, '\n');
             break;
         }
 
-        interpret(vm, line);
+        if (interpret(vm, line) == INTERPRET_OK) {
+            output_value(&vm->output, vm->result);
+            output_char(&vm->output, '\n');
+        }
     }
 }
 
-static char* read_file(const char* path) {
-    FILE* file = fopen(path, "rb");
+static int run_file(VM* vm, const Options* options) {
+    const char* path = options->path;
 
-    if (!file) {
-        fprintf(stderr, "Could not open file '%s'.", path);
+    Source source;
+    if (!open_source(&source, path)) {
+        fprintf(stderr, "Could not read file '%s'.", path);
         exit(EXIT_COULD_NOT_READ_FILE);
     }
 
-    fseek(file, 0L, SEEK_END);
-    size_t file_size = ftell(file);
-    rewind(file);
+    uint64_t source_hash = hash_source(source.text, source.length);
 
-    char* buffer = (char*)malloc(file_size + 1);
+    Chunk chunk;
+    if (!load_chunk(vm, options, &source, source_hash, &chunk)) {
+        close_source(&source);
+        return EXIT_COMPILE_ERROR;
+    }
 
-    if (!buffer) {
-        fprintf(stderr, "Not enough memory to read '%s'.", path);
-        exit(EXIT_COULD_NOT_READ_FILE);
+    if (options->decode_trace_path) {
+        bool ok = decode_trace(options->decode_trace_path, &chunk, source_hash, !options->no_fold);
+        close_source(&source);
+        return ok ? EXIT_SUCCESS : EXIT_COULD_NOT_READ_FILE;
+    }
+
+    TraceBuffer trace;
+    if (options->trace_path) {
+        if (!init_trace_buffer(&trace, TRACE_DEFAULT_CAPACITY)) {
+            fprintf(stderr, "Could not allocate the trace buffer.\n");
+            exit(1);
+        }
+        vm->trace = &trace;
+    }
+
+    Profile profile;
+    if (options->profile) {
+        if (!init_profile(&profile, &chunk)) {
+            fprintf(stderr, "Could not allocate the profile.\n");
+            exit(1);
+        }
+        vm->profile = &profile;
     }
 
-    size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
+    InterpreterResult result = interpret_chunk(vm, &chunk);
+    if (result == INTERPRET_OK) {
+        output_value(&vm->output, vm->result);
+        output_char(&vm->output, '\n');
+    }
+    // Ahead of the profile, which is printed through stdio.
+    flush_output(&vm->output);
+
+    if (options->profile) {
+        vm->profile = NULL;
+        print_profile(&profile, &chunk);
+        free_profile(&profile);
+    }
 
-    if (bytes_read < file_size) {
+    // Saved whatever the outcome: the last instructions before an error are
+    // the interesting ones.
+    if (options->trace_path) {
+        vm->trace = NULL;
+        if (!save_trace(options->trace_path, &trace, source_hash, !options->no_fold)) {
+            fprintf(stderr, "Could not write trace '%s'.\n", options->trace_path);
+        }
+        free_trace_buffer(&trace);
+    }
+
+    close_source(&source);
+
+    if (result == INTERPRET_COMPILE_ERROR) return EXIT_COMPILE_ERROR;
+    if (result == INTERPRET_RUNTIME_ERROR) return EXIT_RUNTIME_ERROR;
+    return EXIT_SUCCESS;
+}
+
+static int run_batch_input(VM* vm, const Options* options) {
+    int fd = STDIN_FILENO;
+    if (options->path) {
+        fd = open(options->path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Could not read file '%s'.", options->path);
+            exit(EXIT_COULD_NOT_READ_FILE);
+        }
+    }
+
+    bool ok;
+    if (options->jobs > 1) {
+        WorkerPool pool;
+        if (!init_worker_pool(&pool, options->jobs, options->registers)) {
+            fprintf(stderr, "Could not start %d workers.\n", options->jobs);
+            exit(1);
+        }
+
+        ok = run_batch_parallel(&pool, fd, &vm->output);
+        free_worker_pool(&pool);
+    } else {
+        ok = run_batch(vm, fd, &vm->output);
+    }
+    if (fd != STDIN_FILENO) close(fd);
+
+    if (!ok) {
+        fprintf(stderr, "Could not read the batch input.\n");
+        return EXIT_COULD_NOT_READ_FILE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int emit_file(VM* vm, const Options* options) {
+    const char* path = options->path;
+
+    Source source;
+    if (!open_source(&source, path)) {
         fprintf(stderr, "Could not read file '%s'.", path);
         exit(EXIT_COULD_NOT_READ_FILE);
     }
 
-    buffer[bytes_read] = '\0';
+    Chunk chunk;
+    bool ok = load_chunk(vm, options, &source, hash_source(source.text, source.length), &chunk);
+    close_source(&source);
+    if (!ok) return EXIT_COMPILE_ERROR;
 
-    fclose(file);
-    return buffer;
+    if (!emit_c(&chunk, path, stdout)) {
+        fprintf(stderr, "Could not write C for '%s'.\n", path);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
 }
 
-static void run_file(VM* vm, const char* path) {
-    char* source = read_file(path);
-    InterpreterResult result = interpret(vm, source);
-    free(source);
+static bool load_chunk(VM* vm, const Options* options, Source* source, uint64_t source_hash,
+                       Chunk* chunk) {
+    // Build the chunk in the VM's arena so it shows up in its memory stats.
+    reset_arena(&vm->arena);
+    init_chunk(chunk, &vm->arena);
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(EXIT_COMPILE_ERROR);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(EXIT_RUNTIME_ERROR);
-}
\ No newline at end of file
+    // The cache only ever holds folded chunks.
+    if (options->no_fold) return compile_unfolded(source->text, chunk, vm->errors);
+
+    // Nothing sensible sits next to /dev/stdin or a process substitution.
+    if (!source->regular_file) return compile(source->text, chunk, vm->errors);
+
+    char* cache_path = cache_path_for(options->path);
+
+    // Reuse the precompiled chunk when it was built from this exact source.
+    if (!cache_path || !load_chunk_cache(cache_path, source_hash, chunk)) {
+        if (!compile(source->text, chunk, vm->errors)) {
+            free(cache_path);
+            return false;
+        }
+
+        // Best effort: an unwritable directory just means no cache.
+        if (cache_path) save_chunk_cache(cache_path, chunk, source_hash);
+    }
+
+    free(cache_path);
+    return true;
+}
@@ -3,10 +3,142 @@
 //
 
 #include <stdio.h>
+#include <string.h>
 
 #include "memory.h"
 
-void* reallocate(void* pointer, size_t old_size, size_t new_size) {
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t size;
+    size_t used;
+};
+
+// Block headers are padded so that the data after them stays aligned.
+#define BLOCK_HEADER_SIZE \
+    ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT)
+
+// Forward declarations
+
+static void* arena_reallocate(Arena*, void* pointer, size_t old_size, size_t new_size);
+static void* arena_allocate(Arena*, size_t size);
+static void count_reallocation(MemoryStats*, bool shared, MemorySite, void* pointer,
+                               size_t old_size, size_t new_size);
+static size_t add_count(size_t* counter, size_t amount, bool shared);
+static void raise_peak(size_t* peak, size_t current, bool shared);
+static int histogram_bucket(size_t size);
+static ArenaBlock* new_block(MemoryStats*, size_t size);
+static char* block_data(ArenaBlock*);
+static size_t align(size_t size);
+
+static const char* const site_names[] = {
+    [MEMORY_SITE_CODE]           = "code",
+    [MEMORY_SITE_LINES]          = "lines",
+    [MEMORY_SITE_CONSTANTS]      = "constants",
+    [MEMORY_SITE_CONSTANT_INDEX] = "constant index",
+    [MEMORY_SITE_TOKENS]         = "tokens",
+    [MEMORY_SITE_OPTIMIZER]      = "optimizer",
+    [MEMORY_SITE_REGISTERS]      = "registers",
+    [MEMORY_SITE_JIT]            = "jit",
+};
+
+// Shared by every thread, so only ever updated atomically.
+static MemoryStats heap_stats;
+
+// Public
+
+void init_memory_stats(MemoryStats* stats) {
+    memset(stats, 0, sizeof(MemoryStats));
+}
+
+void print_memory_stats(FILE* out, const MemoryStats* stats) {
+    fprintf(out, "%-16s %12s %12s %10s %10s %10s\n",
+            "site", "current", "peak", "allocs", "reallocs", "frees");
+
+    size_t histogram[MEMORY_HISTOGRAM_BUCKETS] = {0};
+    size_t allocations = 0, reallocations = 0, frees = 0;
+
+    for (int i = 0; i < MEMORY_SITE_COUNT; i += 1) {
+        const SiteStats* site = &stats->sites[i];
+        fprintf(out, "%-16s %12zu %12zu %10zu %10zu %10zu\n", site_names[i],
+                site->current_bytes, site->peak_bytes,
+                site->allocations, site->reallocations, site->frees);
+
+        allocations += site->allocations;
+        reallocations += site->reallocations;
+        frees += site->frees;
+        for (int bucket = 0; bucket < MEMORY_HISTOGRAM_BUCKETS; bucket += 1) {
+            histogram[bucket] += site->histogram[bucket];
+        }
+    }
+
+    fprintf(out, "%-16s %12zu %12zu %10zu %10zu %10zu\n", "total",
+            stats->current_bytes, stats->peak_bytes, allocations, reallocations, frees);
+    if (stats->blocks > 0) {
+        fprintf(out, "arena: %zu bytes reserved in %zu blocks\n", stats->reserved_bytes, stats->blocks);
+    }
+
+    fprintf(out, "request sizes:\n");
+    for (int bucket = 0; bucket < MEMORY_HISTOGRAM_BUCKETS; bucket += 1) {
+        if (histogram[bucket] == 0) continue;
+
+        if (bucket == MEMORY_HISTOGRAM_BUCKETS - 1) {
+            fprintf(out, "  > %10zu %10zu\n", (size_t)1 << (bucket + 3), histogram[bucket]);
+        } else {
+            fprintf(out, "  <= %9zu %10zu\n", (size_t)1 << (bucket + 4), histogram[bucket]);
+        }
+    }
+}
+
+void get_heap_memory_stats(MemoryStats* stats) {
+    // Every field is a size_t, so the struct reads as an array of them.
+    const size_t* from = (const size_t*)&heap_stats;
+    size_t* to = (size_t*)stats;
+    for (size_t i = 0; i < sizeof(MemoryStats) / sizeof(size_t); i += 1) {
+        to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+    }
+}
+
+void init_arena(Arena* arena) {
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->last = NULL;
+    init_memory_stats(&arena->stats);
+}
+
+void reset_arena(Arena* arena) {
+    // Later blocks are emptied as allocation reaches them again.
+    arena->current = arena->first;
+    if (arena->current) arena->current->used = 0;
+    arena->last = NULL;
+
+    for (int i = 0; i < MEMORY_SITE_COUNT; i += 1) {
+        arena->stats.sites[i].current_bytes = 0;
+    }
+    arena->stats.current_bytes = 0;
+}
+
+void free_arena(Arena* arena) {
+    ArenaBlock* block = arena->first;
+    while (block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    init_arena(arena);
+}
+
+void* reallocate(Arena* arena, MemorySite site, void* pointer, size_t old_size, size_t new_size) {
+    if (arena) {
+        count_reallocation(&arena->stats, false, site, pointer, old_size, new_size);
+        return arena_reallocate(arena, pointer, old_size, new_size);
+    }
+
+    count_reallocation(&heap_stats, true, site, pointer, old_size, new_size);
+
     if (new_size == 0) {
         free(pointer);
         return NULL;
@@ -20,4 +152,144 @@ void* reallocate(void* pointer, size_t old_size, size_t new_size) {
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+// Private
+
+static void* arena_reallocate(Arena* arena, void* pointer, size_t old_size, size_t new_size) {
+    ArenaBlock* block = arena->current;
+
+    // The newest allocation can shrink, grow or be released in place.
+    if (pointer && pointer == arena->last) {
+        size_t start = (size_t)((char*)pointer - block_data(block));
+
+        if (start + new_size <= block->size) {
+            block->used = start + align(new_size);
+            if (new_size == 0) arena->last = NULL;
+            return new_size == 0 ? NULL : pointer;
+        }
+    }
+
+    // Anything else is left in place until the arena is reset.
+    if (new_size == 0) return NULL;
+
+    void* result = arena_allocate(arena, new_size);
+    if (pointer) memcpy(result, pointer, old_size < new_size ? old_size : new_size);
+    return result;
+}
+
+static void* arena_allocate(Arena* arena, size_t size) {
+    size = align(size);
+    ArenaBlock* block = arena->current;
+
+    if (!block || block->used + size > block->size) {
+        ArenaBlock* next = block ? block->next : arena->first;
+
+        if (next && next->size >= size) {
+            // Reuse a block kept from before the last reset.
+            next->used = 0;
+        } else {
+            next = new_block(&arena->stats, size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+
+            if (block) {
+                next->next = block->next;
+                block->next = next;
+            } else {
+                next->next = arena->first;
+                arena->first = next;
+            }
+        }
+
+        arena->current = block = next;
+    }
+
+    void* result = block_data(block) + block->used;
+    block->used += size;
+    arena->last = result;
+    return result;
+}
+
+// Shared stats are updated atomically. Byte counts go down by adding the
+// two's complement, which size_t arithmetic wraps back to the right value.
+static void count_reallocation(MemoryStats* stats, bool shared, MemorySite site_id, void* pointer,
+                               size_t old_size, size_t new_size) {
+    SiteStats* site = &stats->sites[site_id];
+
+    // Freeing NULL is a no-op, and says nothing about the workload.
+    if (new_size == 0) {
+        if (!pointer) return;
+        add_count(&site->frees, 1, shared);
+    } else {
+        if (pointer) {
+            add_count(&site->reallocations, 1, shared);
+        } else {
+            add_count(&site->allocations, 1, shared);
+        }
+        add_count(&site->histogram[histogram_bucket(new_size)], 1, shared);
+    }
+
+    if (!pointer) old_size = 0;
+    size_t site_bytes = add_count(&site->current_bytes, new_size - old_size, shared);
+    size_t total_bytes = add_count(&stats->current_bytes, new_size - old_size, shared);
+
+    raise_peak(&site->peak_bytes, site_bytes, shared);
+    raise_peak(&stats->peak_bytes, total_bytes, shared);
+}
+
+// Returns the new value.
+static size_t add_count(size_t* counter, size_t amount, bool shared) {
+    if (shared) return __atomic_add_fetch(counter, amount, __ATOMIC_RELAXED);
+
+    *counter += amount;
+    return *counter;
+}
+
+static void raise_peak(size_t* peak, size_t current, bool shared) {
+    if (!shared) {
+        if (current > *peak) *peak = current;
+        return;
+    }
+
+    size_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (current > seen &&
+           !__atomic_compare_exchange_n(peak, &seen, current, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static int histogram_bucket(size_t size) {
+    int bucket = 0;
+    size_t limit = 16;
+
+    while (size > limit && bucket < MEMORY_HISTOGRAM_BUCKETS - 1) {
+        limit <<= 1;
+        bucket += 1;
+    }
+
+    return bucket;
+}
+
+static ArenaBlock* new_block(MemoryStats* stats, size_t size) {
+    ArenaBlock* block = malloc(BLOCK_HEADER_SIZE + size);
+
+    if (!block) {
+        fprintf(stderr, "could not realloc memory, failing...");
+        exit(1);
+    }
+
+    stats->reserved_bytes += BLOCK_HEADER_SIZE + size;
+    stats->blocks += 1;
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+static char* block_data(ArenaBlock* block) {
+    return (char*)block + BLOCK_HEADER_SIZE;
+}
+
+static size_t align(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
@@ -7,15 +7,83 @@
 
 #include "common.h"
 
+#include <stdio.h>
+
+// Who asked for the memory. Every GROW_ARRAY and FREE_ARRAY names one.
+typedef enum {
+    MEMORY_SITE_CODE,
+    MEMORY_SITE_LINES,
+    MEMORY_SITE_CONSTANTS,
+    MEMORY_SITE_CONSTANT_INDEX,
+    MEMORY_SITE_TOKENS,
+    MEMORY_SITE_OPTIMIZER,
+    MEMORY_SITE_REGISTERS,
+    MEMORY_SITE_JIT,
+    MEMORY_SITE_COUNT
+} MemorySite;
+
+// Bucket i counts requests of at most 2^(i + 4) bytes; the last one also
+// takes everything larger.
+#define MEMORY_HISTOGRAM_BUCKETS 20
+
+typedef struct {
+    size_t current_bytes;
+    size_t peak_bytes;
+    size_t allocations;
+    size_t reallocations;
+    size_t frees;
+    size_t histogram[MEMORY_HISTOGRAM_BUCKETS];
+} SiteStats;
+
+typedef struct {
+    SiteStats sites[MEMORY_SITE_COUNT];
+    size_t current_bytes;
+    size_t peak_bytes;
+
+    // What the arena actually took from malloc to serve the above. Zero for
+    // the heap, which serves each request straight from malloc.
+    size_t reserved_bytes;
+    size_t blocks;
+} MemoryStats;
+
+void init_memory_stats(MemoryStats*);
+void print_memory_stats(FILE*, const MemoryStats*);
+
+// A snapshot of the counters for everything allocated outside an arena, by
+// every thread: lox_compile() programs, lox_run() copies and translations,
+// and JIT assembly buffers. These outlive any one run, so they are what an
+// embedder sizes, and no VM's stats include them.
+void get_heap_memory_stats(MemoryStats*);
+
+// A bump allocator for data that lives as long as one compilation or run.
+// Blocks are kept across resets, so a reused arena stops calling malloc once
+// it has grown to fit its workload.
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock* first;
+    ArenaBlock* current;
+    void* last; // The newest allocation, which can be resized in place.
+
+    // Counters survive resets; only current_bytes goes back to zero.
+    MemoryStats stats;
+} Arena;
+
+void init_arena(Arena*);
+void reset_arena(Arena*);
+void free_arena(Arena*);
+
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity) * 2)
 
-#define GROW_ARRAY(type, pointer, old_count, new_count) \
-    (type*)reallocate(pointer, sizeof(type) * (old_count), sizeof(type) * (new_count))
+#define GROW_ARRAY(arena, site, type, pointer, old_count, new_count) \
+    (type*)reallocate(arena, site, pointer, sizeof(type) * (old_count), sizeof(type) * (new_count))
 
-#define FREE_ARRAY(type, pointer, old_count) \
-    reallocate(pointer, sizeof(type) * (old_count), 0)
+#define FREE_ARRAY(arena, site, type, pointer, old_count) \
+    reallocate(arena, site, pointer, sizeof(type) * (old_count), 0)
 
-void* reallocate(void* pointer, size_t old_size, size_t new_size);
+// Allocates from arena, or from the heap when arena is NULL. Either way the
+// request is counted, in the arena's stats or in the heap's.
+void* reallocate(Arena* arena, MemorySite site, void* pointer, size_t old_size, size_t new_size);
 
 #endif //LOX_MEMORY_H
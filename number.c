@@ -0,0 +1,444 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#include <math.h>
+
+#include "number.h"
+
+// Grisu3, after Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+// Accurately with Integers" (PLDI 2010). The double and the two boundaries
+// halfway to its neighbours are scaled by a cached power of ten, so their
+// integer parts hold the leading digits. Digits are generated from the upper
+// boundary until the remainder falls inside the boundaries, then the last one
+// is nudged towards the exact value. The scaling is inexact, and for about
+// one double in two hundred that leaves the shortest digits in doubt; those
+// go through printf and strtod instead.
+//
+// Integers below 2^53 skip all that: their digits are exact.
+//
+// Reading goes the other way. The scanner hands over the digits as a 64-bit
+// integer and a power of ten; when both are exact doubles, one division or
+// multiplication is correctly rounded. Anything else goes to strtod.
+
+// A floating-point number f * 2^e with a 64-bit significand.
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+typedef struct {
+    uint64_t f;
+    int e;
+    int k; // Power of ten f * 2^e approximates.
+} CachedPower;
+
+// Scaled products land in [2^ALPHA, 2^GAMMA) times 2^64, which leaves the
+// integer part in 32 bits.
+#define GRISU_ALPHA (-60)
+#define GRISU_GAMMA (-32)
+
+#define CACHED_POWERS_MIN_EXPONENT (-300)
+#define CACHED_POWERS_STEP 8
+
+// 10^k for k = -300, -292, ... 324, as normalized significands rounded to
+// nearest with their binary exponents.
+static const CachedPower cached_powers[] = {
+    { 0xAB70FE17C79AC6CA, -1060, -300 },
+    { 0xFF77B1FCBEBCDC4F, -1034, -292 },
+    { 0xBE5691EF416BD60C, -1007, -284 },
+    { 0x8DD01FAD907FFC3C,  -980, -276 },
+    { 0xD3515C2831559A83,  -954, -268 },
+    { 0x9D71AC8FADA6C9B5,  -927, -260 },
+    { 0xEA9C227723EE8BCB,  -901, -252 },
+    { 0xAECC49914078536D,  -874, -244 },
+    { 0x823C12795DB6CE57,  -847, -236 },
+    { 0xC21094364DFB5637,  -821, -228 },
+    { 0x9096EA6F3848984F,  -794, -220 },
+    { 0xD77485CB25823AC7,  -768, -212 },
+    { 0xA086CFCD97BF97F4,  -741, -204 },
+    { 0xEF340A98172AACE5,  -715, -196 },
+    { 0xB23867FB2A35B28E,  -688, -188 },
+    { 0x84C8D4DFD2C63F3B,  -661, -180 },
+    { 0xC5DD44271AD3CDBA,  -635, -172 },
+    { 0x936B9FCEBB25C996,  -608, -164 },
+    { 0xDBAC6C247D62A584,  -582, -156 },
+    { 0xA3AB66580D5FDAF6,  -555, -148 },
+    { 0xF3E2F893DEC3F126,  -529, -140 },
+    { 0xB5B5ADA8AAFF80B8,  -502, -132 },
+    { 0x87625F056C7C4A8B,  -475, -124 },
+    { 0xC9BCFF6034C13053,  -449, -116 },
+    { 0x964E858C91BA2655,  -422, -108 },
+    { 0xDFF9772470297EBD,  -396, -100 },
+    { 0xA6DFBD9FB8E5B88F,  -369,  -92 },
+    { 0xF8A95FCF88747D94,  -343,  -84 },
+    { 0xB94470938FA89BCF,  -316,  -76 },
+    { 0x8A08F0F8BF0F156B,  -289,  -68 },
+    { 0xCDB02555653131B6,  -263,  -60 },
+    { 0x993FE2C6D07B7FAC,  -236,  -52 },
+    { 0xE45C10C42A2B3B06,  -210,  -44 },
+    { 0xAA242499697392D3,  -183,  -36 },
+    { 0xFD87B5F28300CA0E,  -157,  -28 },
+    { 0xBCE5086492111AEB,  -130,  -20 },
+    { 0x8CBCCC096F5088CC,  -103,  -12 },
+    { 0xD1B71758E219652C,   -77,   -4 },
+    { 0x9C40000000000000,   -50,    4 },
+    { 0xE8D4A51000000000,   -24,   12 },
+    { 0xAD78EBC5AC620000,     3,   20 },
+    { 0x813F3978F8940984,    30,   28 },
+    { 0xC097CE7BC90715B3,    56,   36 },
+    { 0x8F7E32CE7BEA5C70,    83,   44 },
+    { 0xD5D238A4ABE98068,   109,   52 },
+    { 0x9F4F2726179A2245,   136,   60 },
+    { 0xED63A231D4C4FB27,   162,   68 },
+    { 0xB0DE65388CC8ADA8,   189,   76 },
+    { 0x83C7088E1AAB65DB,   216,   84 },
+    { 0xC45D1DF942711D9A,   242,   92 },
+    { 0x924D692CA61BE758,   269,  100 },
+    { 0xDA01EE641A708DEA,   295,  108 },
+    { 0xA26DA3999AEF774A,   322,  116 },
+    { 0xF209787BB47D6B85,   348,  124 },
+    { 0xB454E4A179DD1877,   375,  132 },
+    { 0x865B86925B9BC5C2,   402,  140 },
+    { 0xC83553C5C8965D3D,   428,  148 },
+    { 0x952AB45CFA97A0B3,   455,  156 },
+    { 0xDE469FBD99A05FE3,   481,  164 },
+    { 0xA59BC234DB398C25,   508,  172 },
+    { 0xF6C69A72A3989F5C,   534,  180 },
+    { 0xB7DCBF5354E9BECE,   561,  188 },
+    { 0x88FCF317F22241E2,   588,  196 },
+    { 0xCC20CE9BD35C78A5,   614,  204 },
+    { 0x98165AF37B2153DF,   641,  212 },
+    { 0xE2A0B5DC971F303A,   667,  220 },
+    { 0xA8D9D1535CE3B396,   694,  228 },
+    { 0xFB9B7CD9A4A7443C,   720,  236 },
+    { 0xBB764C4CA7A44410,   747,  244 },
+    { 0x8BAB8EEFB6409C1A,   774,  252 },
+    { 0xD01FEF10A657842C,   800,  260 },
+    { 0x9B10A4E5E9913129,   827,  268 },
+    { 0xE7109BFBA19C0C9D,   853,  276 },
+    { 0xAC2820D9623BF429,   880,  284 },
+    { 0x80444B5E7AA7CF85,   907,  292 },
+    { 0xBF21E44003ACDD2D,   933,  300 },
+    { 0x8E679C2F5E44FF8F,   960,  308 },
+    { 0xD433179D9C8CB841,   986,  316 },
+    { 0x9E19DB92B4E31BA9,  1013,  324 },
+};
+
+// Every power of ten a double holds exactly.
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define EXACT_POWER_OF_TEN_MAX 22
+
+// Forward declarations
+
+static int format_integer(uint64_t, char* buffer);
+static bool grisu3(double, char* digits, int* length, int* exponent);
+static int shortest_by_printf(double, char* digits, int* exponent);
+static int format_digits(const char* digits, int length, int exponent, char* buffer);
+
+static DiyFp diy_fp_subtract(DiyFp, DiyFp);
+static DiyFp diy_fp_multiply(DiyFp, DiyFp);
+static DiyFp diy_fp_normalize(DiyFp);
+static DiyFp diy_fp_normalize_to(DiyFp, int e);
+
+// Public
+
+int format_number(double value, char* buffer) {
+    if (isnan(value)) return sprintf(buffer, "nan");
+
+    int length = 0;
+    if (signbit(value)) {
+        buffer[length++] = '-';
+        value = -value;
+    }
+
+    if (isinf(value)) {
+        memcpy(buffer + length, "inf", 4);
+        return length + 3;
+    }
+
+    if (value == 0) {
+        memcpy(buffer + length, "0", 2);
+        return length + 1;
+    }
+
+    if (value < 9007199254740992.0 && value == (double)(uint64_t)value) {
+        return length + format_integer((uint64_t)value, buffer + length);
+    }
+
+    char digits[18];
+    int count, exponent;
+    if (!grisu3(value, digits, &count, &exponent)) {
+        count = shortest_by_printf(value, digits, &exponent);
+    }
+    return length + format_digits(digits, count, exponent, buffer + length);
+}
+
+bool decimal_to_double(uint64_t mantissa, int exponent, double* value) {
+    // Converting a 64-bit integer rounds correctly on its own.
+    if (exponent == 0) {
+        *value = (double)mantissa;
+        return true;
+    }
+
+    // Both operands exact, so the one rounding is the only one.
+    if (mantissa > ((uint64_t)1 << 53)) return false;
+    if (exponent < -EXACT_POWER_OF_TEN_MAX || exponent > EXACT_POWER_OF_TEN_MAX) return false;
+
+    *value = exponent < 0 ? (double)mantissa / exact_powers_of_ten[-exponent]
+                          : (double)mantissa * exact_powers_of_ten[exponent];
+    return true;
+}
+
+double parse_number(const char* start, int length) {
+    char small[64];
+    char* text = length < (int)sizeof(small) ? small : malloc((size_t)length + 1);
+    if (!text) return strtod(start, NULL);
+
+    // strtod reads the decimal point of the current locale, and would read
+    // past the literal into forms Lox does not have, like 1e5 or 0x10.
+    char point = localeconv()->decimal_point[0];
+    for (int i = 0; i < length; i += 1) text[i] = start[i] == '.' ? point : start[i];
+    text[length] = '\0';
+
+    double value = strtod(text, NULL);
+    if (text != small) free(text);
+    return value;
+}
+
+// Private
+
+static int format_integer(uint64_t value, char* buffer) {
+    char reversed[20];
+    int count = 0;
+
+    do {
+        reversed[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    for (int i = 0; i < count; i += 1) buffer[i] = reversed[count - 1 - i];
+    buffer[count] = '\0';
+    return count;
+}
+
+// The largest power of ten no larger than n, and how many digits n has.
+static int largest_power_of_ten(uint32_t n, uint32_t* power) {
+    static const uint32_t powers[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+    };
+
+    int digits = 10;
+    while (digits > 1 && n < powers[digits - 1]) digits -= 1;
+    *power = powers[digits - 1];
+    return digits;
+}
+
+// Moves the last digit down towards w while that keeps it inside the
+// interval, then reports whether the digits are certainly the closest
+// shortest ones. All quantities are distances below the upper end of the
+// interval, which is known to within unit.
+static bool round_weed(char* digits, int length, uint64_t distance_high_w, uint64_t unsafe_interval,
+                       uint64_t rest, uint64_t ten_kappa, uint64_t unit) {
+    uint64_t small_distance = distance_high_w - unit;
+    uint64_t big_distance = distance_high_w + unit;
+
+    while (rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+           (rest + ten_kappa < small_distance ||
+            small_distance - rest >= rest + ten_kappa - small_distance)) {
+        digits[length - 1] -= 1;
+        rest += ten_kappa;
+    }
+
+    // Had w been at the far end of its error, would another digit be closer?
+    if (rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+        (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance)) {
+        return false;
+    }
+
+    // Is the result inside the interval even in the worst case?
+    return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+// Positive, finite, non-zero values only. Writes the digits, without a
+// terminator, and sets exponent so the value is digits * 10^exponent. Fails
+// for the few values where the error in the scaled products leaves the
+// shortest digits in doubt.
+static bool grisu3(double value, char* digits, int* length, int* exponent) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+
+    uint64_t fraction = bits & (((uint64_t)1 << 52) - 1);
+    int biased = (int)(bits >> 52);
+
+    // The value and its boundaries, halfway to the neighbouring doubles.
+    // Below a power of two the lower neighbour is twice as close.
+    DiyFp v = biased == 0 ? (DiyFp){ fraction, 1 - 1075 }
+                          : (DiyFp){ fraction + ((uint64_t)1 << 52), biased - 1075 };
+    bool lower_closer = fraction == 0 && biased > 1;
+
+    DiyFp high = diy_fp_normalize((DiyFp){ 2 * v.f + 1, v.e - 1 });
+    DiyFp low = lower_closer ? (DiyFp){ 4 * v.f - 1, v.e - 2 } : (DiyFp){ 2 * v.f - 1, v.e - 1 };
+    low = diy_fp_normalize_to(low, high.e);
+    DiyFp w = diy_fp_normalize(v);
+
+    // The cached power c ~ 10^k that moves high.e into [ALPHA, GAMMA]:
+    // k = ceil((ALPHA - e - 1) * log10(2)).
+    int f = GRISU_ALPHA - high.e - 1;
+    int k = (f * 78913) / (1 << 18) + (f > 0);
+    int index = (-CACHED_POWERS_MIN_EXPONENT + k + (CACHED_POWERS_STEP - 1)) / CACHED_POWERS_STEP;
+    CachedPower cached = cached_powers[index];
+    DiyFp c = { cached.f, cached.e };
+
+    w = diy_fp_multiply(w, c);
+    low = diy_fp_multiply(low, c);
+    high = diy_fp_multiply(high, c);
+
+    // Each product is off by less than one unit, so the real interval lies
+    // between too_low and too_high. Digits are generated from the top.
+    uint64_t unit = 1;
+    DiyFp too_low = { low.f - unit, low.e };
+    DiyFp too_high = { high.f + unit, high.e };
+    uint64_t unsafe_interval = diy_fp_subtract(too_high, too_low).f;
+
+    // too_high = integrals + fractionals * 2^e.
+    DiyFp one = { (uint64_t)1 << -w.e, w.e };
+    uint32_t integrals = (uint32_t)(too_high.f >> -one.e);
+    uint64_t fractionals = too_high.f & (one.f - 1);
+
+    uint32_t power;
+    int kappa = largest_power_of_ten(integrals, &power);
+    *length = 0;
+
+    while (kappa > 0) {
+        digits[(*length)++] = (char)('0' + integrals / power);
+        integrals %= power;
+        kappa -= 1;
+
+        uint64_t rest = ((uint64_t)integrals << -one.e) + fractionals;
+        if (rest < unsafe_interval) {
+            *exponent = kappa - cached.k;
+            return round_weed(digits, *length, diy_fp_subtract(too_high, w).f, unsafe_interval,
+                              rest, (uint64_t)power << -one.e, unit);
+        }
+
+        power /= 10;
+    }
+
+    while (true) {
+        fractionals *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+
+        digits[(*length)++] = (char)('0' + (fractionals >> -one.e));
+        fractionals &= one.f - 1;
+        kappa -= 1;
+
+        if (fractionals < unsafe_interval) {
+            *exponent = kappa - cached.k;
+            return round_weed(digits, *length, diy_fp_subtract(too_high, w).f * unit,
+                              unsafe_interval, fractionals, one.f, unit);
+        }
+    }
+}
+
+// The slow, sure way: the fewest significant digits printf can round the
+// value to that read back as the same double.
+static int shortest_by_printf(double value, char* digits, int* exponent) {
+    char text[NUMBER_BUFFER_SIZE];
+
+    for (int precision = 1; precision <= 17; precision += 1) {
+        snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+        if (strtod(text, NULL) != value && precision < 17) continue;
+
+        // text is "d.ddde+x", or "de+x" for one digit.
+        int length = 0;
+        const char* c = text;
+        for (; *c != 'e'; c += 1) {
+            if (*c != '.') digits[length++] = *c;
+        }
+        *exponent = atoi(c + 1) - (length - 1);
+        return length;
+    }
+
+    return 0;
+}
+
+// digits * 10^exponent, laid out the way JavaScript's Number#toString does.
+static int format_digits(const char* digits, int length, int exponent, char* buffer) {
+    // The value is 0.digits * 10^point.
+    int point = length + exponent;
+
+    if (length <= point && point <= 21) {
+        memcpy(buffer, digits, (size_t)length);
+        memset(buffer + length, '0', (size_t)(point - length));
+        buffer[point] = '\0';
+        return point;
+    }
+
+    if (0 < point && point <= 21) {
+        memcpy(buffer, digits, (size_t)point);
+        buffer[point] = '.';
+        memcpy(buffer + point + 1, digits + point, (size_t)(length - point));
+        buffer[length + 1] = '\0';
+        return length + 1;
+    }
+
+    if (-6 < point && point <= 0) {
+        buffer[0] = '0';
+        buffer[1] = '.';
+        memset(buffer + 2, '0', (size_t)-point);
+        memcpy(buffer + 2 - point, digits, (size_t)length);
+        buffer[2 - point + length] = '\0';
+        return 2 - point + length;
+    }
+
+    int count = 0;
+    buffer[count++] = digits[0];
+    if (length > 1) {
+        buffer[count++] = '.';
+        memcpy(buffer + count, digits + 1, (size_t)(length - 1));
+        count += length - 1;
+    }
+
+    return count + sprintf(buffer + count, "e%+d", point - 1);
+}
+
+static DiyFp diy_fp_subtract(DiyFp x, DiyFp y) {
+    return (DiyFp){ x.f - y.f, x.e };
+}
+
+// The upper 64 bits of the 128-bit product, rounded.
+static DiyFp diy_fp_multiply(DiyFp x, DiyFp y) {
+    uint64_t x_lo = x.f & 0xffffffff, x_hi = x.f >> 32;
+    uint64_t y_lo = y.f & 0xffffffff, y_hi = y.f >> 32;
+
+    uint64_t lo_lo = x_lo * y_lo;
+    uint64_t lo_hi = x_lo * y_hi;
+    uint64_t hi_lo = x_hi * y_lo;
+    uint64_t hi_hi = x_hi * y_hi;
+
+    uint64_t middle = (lo_lo >> 32) + (lo_hi & 0xffffffff) + (hi_lo & 0xffffffff);
+    middle += (uint64_t)1 << 31;
+
+    return (DiyFp){ hi_hi + (lo_hi >> 32) + (hi_lo >> 32) + (middle >> 32), x.e + y.e + 64 };
+}
+
+static DiyFp diy_fp_normalize(DiyFp x) {
+    while ((x.f >> 63) == 0) {
+        x.f <<= 1;
+        x.e -= 1;
+    }
+    return x;
+}
+
+static DiyFp diy_fp_normalize_to(DiyFp x, int e) {
+    return (DiyFp){ x.f << (x.e - e), e };
+}
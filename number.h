@@ -0,0 +1,30 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_NUMBER_H
+#define LOX_NUMBER_H
+
+#include "common.h"
+
+// Longest text format_number() writes, "-1.2345678901234567e-308", plus NUL.
+#define NUMBER_BUFFER_SIZE 32
+
+// Writes the shortest text that reads back as exactly the same double,
+// NUL-terminated, and returns its length. Numbers from 1e-7 up to 1e21 are
+// written out in full, others in exponent form, as JavaScript does: 2000000,
+// 0.1, 1e+21, 1.5e-7. Infinities and NaN print as inf, -inf and nan.
+int format_number(double, char* buffer);
+
+// Digits the scanner gathers into a 64-bit mantissa: any 19 fit.
+#define MANTISSA_DIGITS_MAX 19
+
+// mantissa * 10^exponent, when that can be computed exactly with one
+// correctly rounded operation (Clinger's fast path). Fails otherwise.
+bool decimal_to_double(uint64_t mantissa, int exponent, double* value);
+
+// Reads a literal of length bytes, digits with an optional fraction, the
+// slow and sure way. The text need not be NUL-terminated.
+double parse_number(const char* start, int length);
+
+#endif //LOX_NUMBER_H
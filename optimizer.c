@@ -0,0 +1,206 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include "optimizer.h"
+#include "memory.h"
+
+// The peephole pass decodes the finished chunk into a list of instructions,
+// rewrites that list, and re-encodes it into a fresh chunk. Re-encoding also
+// rebuilds the line table and drops constants that folding left unused.
+
+typedef struct {
+    uint8_t op;
+    int constant;
+    int line;
+} Instruction;
+
+typedef struct {
+    int capacity;
+    int count;
+    Instruction* instructions;
+    Arena* arena;
+} InstructionList;
+
+// Forward declarations
+
+static void decode(Chunk*, InstructionList*);
+static void encode(InstructionList*, Chunk* source, Chunk* destination);
+static void push_instruction(InstructionList*, Instruction);
+static bool rewrite_tail(Chunk*, InstructionList*);
+
+static bool produces_bool(Instruction*);
+static bool produces_number(Chunk*, Instruction*);
+
+// Public
+
+void optimize_chunk(Chunk* chunk) {
+    InstructionList decoded = { 0, 0, NULL, chunk->arena };
+    decode(chunk, &decoded);
+
+    // Rewriting after every push lets one fusion expose the next, so
+    // "! ! ! (a < b)" collapses in a single pass.
+    InstructionList optimized = { 0, 0, NULL, chunk->arena };
+    for (int i = 0; i < decoded.count; i += 1) {
+        push_instruction(&optimized, decoded.instructions[i]);
+
+        while (rewrite_tail(chunk, &optimized)) {
+            // Keep going until the tail is stable.
+        }
+    }
+
+    Chunk result;
+    init_chunk(&result, chunk->arena);
+    encode(&optimized, chunk, &result);
+
+    free_chunk(chunk);
+    *chunk = result;
+
+    FREE_ARRAY(decoded.arena, MEMORY_SITE_OPTIMIZER, Instruction, decoded.instructions, decoded.capacity);
+    FREE_ARRAY(optimized.arena, MEMORY_SITE_OPTIMIZER, Instruction, optimized.instructions, optimized.capacity);
+}
+
+// Private
+
+static void push_instruction(InstructionList* list, Instruction instruction) {
+    if (list->capacity < list->count + 1) {
+        int old_capacity = list->capacity;
+        list->capacity = GROW_CAPACITY(old_capacity);
+        list->instructions = GROW_ARRAY(list->arena, MEMORY_SITE_OPTIMIZER, Instruction, list->instructions, old_capacity, list->capacity);
+    }
+
+    list->instructions[list->count] = instruction;
+    list->count += 1;
+}
+
+static void decode(Chunk* chunk, InstructionList* list) {
+    for (int offset = 0; offset < chunk->count;) {
+        Instruction instruction = {
+            .op = chunk->code[offset],
+            .constant = -1,
+            .line = get_line(chunk, offset),
+        };
+
+        switch (instruction.op) {
+            case OP_CONSTANT:
+                instruction.constant = chunk->code[offset + 1];
+                offset += 2;
+                break;
+            case OP_CONSTANT_LONG:
+                instruction.constant = chunk->code[offset + 1] |
+                                       (chunk->code[offset + 2] << 8) |
+                                       (chunk->code[offset + 3] << 16);
+                offset += 4;
+                break;
+            default:
+                offset += 1;
+                break;
+        }
+
+        push_instruction(list, instruction);
+    }
+}
+
+static void encode(InstructionList* list, Chunk* source, Chunk* destination) {
+    for (int i = 0; i < list->count; i += 1) {
+        Instruction* instruction = &list->instructions[i];
+
+        if (instruction->constant < 0) {
+            write_chunk(destination, instruction->op, instruction->line);
+            continue;
+        }
+
+        // Indexes only ever shrink here, so this never overflows 24 bits.
+        int constant = add_constant(destination, source->constants.values[instruction->constant]);
+        if (constant <= UINT8_MAX) {
+            write_chunk(destination, OP_CONSTANT, instruction->line);
+            write_chunk(destination, (uint8_t) constant, instruction->line);
+        } else {
+            write_chunk(destination, OP_CONSTANT_LONG, instruction->line);
+            write_chunk(destination, (uint8_t) (constant & 0xff), instruction->line);
+            write_chunk(destination, (uint8_t) ((constant >> 8) & 0xff), instruction->line);
+            write_chunk(destination, (uint8_t) ((constant >> 16) & 0xff), instruction->line);
+        }
+    }
+}
+
+static OpCode negated_comparison(uint8_t op) {
+    switch (op) {
+        case OP_EQUAL:         return OP_NOT_EQUAL;
+        case OP_NOT_EQUAL:     return OP_EQUAL;
+        case OP_LESS:          return OP_GREATER_EQUAL;
+        case OP_GREATER_EQUAL: return OP_LESS;
+        case OP_GREATER:       return OP_LESS_EQUAL;
+        case OP_LESS_EQUAL:    return OP_GREATER;
+        default:
+            return OP_RETURN; // Not a comparison.
+    }
+}
+
+// Tries one rewrite on the last instructions of the list.
+static bool rewrite_tail(Chunk* chunk, InstructionList* list) {
+    if (list->count < 2) return false;
+
+    Instruction* last = &list->instructions[list->count - 1];
+    Instruction* previous = &list->instructions[list->count - 2];
+    Instruction* before = list->count >= 3 ? &list->instructions[list->count - 3] : NULL;
+
+    if (last->op == OP_NOT) {
+        // A comparison followed by a negation is the opposite comparison.
+        OpCode negated = negated_comparison(previous->op);
+        if (negated != OP_RETURN) {
+            previous->op = negated;
+            list->count -= 1;
+            return true;
+        }
+
+        // Negating a boolean twice gives it back unchanged.
+        if (previous->op == OP_NOT && before && produces_bool(before)) {
+            list->count -= 2;
+            return true;
+        }
+    }
+
+    // Negating a number twice gives it back unchanged. Anything else must
+    // keep both negations so the type error is still raised.
+    if (last->op == OP_NEGATE && previous->op == OP_NEGATE &&
+        before && produces_number(chunk, before)) {
+        list->count -= 2;
+        return true;
+    }
+
+    return false;
+}
+
+static bool produces_bool(Instruction* instruction) {
+    switch (instruction->op) {
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NOT:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool produces_number(Chunk* chunk, Instruction* instruction) {
+    switch (instruction->op) {
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NEGATE:
+            return true;
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+            return IS_NUMBER(chunk->constants.values[instruction->constant]);
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,12 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_OPTIMIZER_H
+#define LOX_OPTIMIZER_H
+
+#include "chunk.h"
+
+void optimize_chunk(Chunk*);
+
+#endif //LOX_OPTIMIZER_H
@@ -0,0 +1,101 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "number.h"
+
+// Forward declarations
+
+static bool reserve(OutputBuffer*, size_t);
+static void write_all(OutputBuffer*, const char*, size_t);
+
+// Public
+
+void init_output(OutputBuffer* output, int fd) {
+    output->fd = fd;
+    output->length = 0;
+    output->data = NULL;
+    output->failed = false;
+}
+
+void free_output(OutputBuffer* output) {
+    flush_output(output);
+    free(output->data);
+    init_output(output, output->fd);
+}
+
+void output_bytes(OutputBuffer* output, const char* bytes, size_t length) {
+    // Too big to be worth copying: send what is buffered, then the bytes.
+    if (length >= OUTPUT_BUFFER_SIZE) {
+        flush_output(output);
+        write_all(output, bytes, length);
+        return;
+    }
+
+    if (!reserve(output, length)) return;
+    memcpy(output->data + output->length, bytes, length);
+    output->length += length;
+}
+
+void output_string(OutputBuffer* output, const char* string) {
+    output_bytes(output, string, strlen(string));
+}
+
+void output_char(OutputBuffer* output, char c) {
+    if (!reserve(output, 1)) return;
+    output->data[output->length++] = c;
+}
+
+void output_long(OutputBuffer* output, long value) {
+    char text[24];
+    int length = snprintf(text, sizeof(text), "%ld", value);
+    output_bytes(output, text, (size_t)length);
+}
+
+void output_value(OutputBuffer* output, Value value) {
+    // Formatted straight into the buffer.
+    if (!reserve(output, NUMBER_BUFFER_SIZE)) return;
+    output->length += (size_t)format_value(value, output->data + output->length);
+}
+
+bool flush_output(OutputBuffer* output) {
+    write_all(output, output->data, output->length);
+    output->length = 0;
+    return !output->failed;
+}
+
+// Private
+
+// Makes room for length more bytes, flushing if need be.
+static bool reserve(OutputBuffer* output, size_t length) {
+    if (!output->data) {
+        output->data = malloc(OUTPUT_BUFFER_SIZE);
+        if (!output->data) {
+            output->failed = true;
+            return false;
+        }
+    }
+
+    if (output->length + length > OUTPUT_BUFFER_SIZE) flush_output(output);
+    return true;
+}
+
+static void write_all(OutputBuffer* output, const char* bytes, size_t length) {
+    while (length > 0 && !output->failed) {
+        ssize_t written = write(output->fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            output->failed = true;
+            break;
+        }
+
+        bytes += written;
+        length -= (size_t)written;
+    }
+}
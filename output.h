@@ -0,0 +1,38 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_OUTPUT_H
+#define LOX_OUTPUT_H
+
+#include <stddef.h>
+
+#include "value.h"
+
+// Bytes gathered before they are written out in one write().
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Text on its way to a file descriptor. It bypasses stdio, so anything
+// printed to the same descriptor through stdio must be flushed first, and
+// the buffer flushed before printing through stdio again.
+typedef struct {
+    int fd;
+    size_t length;
+    char* data; // OUTPUT_BUFFER_SIZE bytes, allocated by the first write.
+    bool failed; // A write failed; later output is dropped.
+} OutputBuffer;
+
+void init_output(OutputBuffer*, int fd);
+// Flushes, then releases the buffer.
+void free_output(OutputBuffer*);
+
+void output_bytes(OutputBuffer*, const char*, size_t);
+void output_string(OutputBuffer*, const char*);
+void output_char(OutputBuffer*, char);
+void output_long(OutputBuffer*, long);
+void output_value(OutputBuffer*, Value);
+
+// Returns false if any write since init_output failed.
+bool flush_output(OutputBuffer*);
+
+#endif //LOX_OUTPUT_H
@@ -0,0 +1,230 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <stdlib.h>
+
+#include "pool.h"
+
+// Work is shared out by ranges of job indices. run_jobs() hands every worker
+// an equal, contiguous range. A worker takes jobs one at a time from the
+// front of its own range. Once that is empty it steals the back half of
+// another worker's range, so a worker stuck with slow jobs gives up the rest
+// of them. Each range has its own lock, held only to move its bounds.
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+} JobRange;
+
+struct Worker {
+    WorkerPool* pool;
+    int index;
+    pthread_t thread;
+    VM vm;
+    JobRange range;
+
+    // Error messages of this worker's jobs, one after another. Rewound at
+    // the start of every generation.
+    FILE* errors;
+    char* messages;
+    size_t messages_size;
+};
+
+// Forward declarations
+
+static void* work(void* worker);
+static bool take_job(Worker*, size_t* job);
+static bool steal_jobs(Worker*);
+static void run_job(Worker*, Job*);
+
+// Public
+
+bool init_worker_pool(WorkerPool* pool, int worker_count, bool use_registers) {
+    pool->worker_count = 0;
+    pool->workers = calloc((size_t)worker_count, sizeof(Worker));
+    if (!pool->workers) return false;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->generation = 0;
+    pool->busy = 0;
+    pool->stopping = false;
+    pool->jobs = NULL;
+
+    for (int i = 0; i < worker_count; i += 1) {
+        Worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->range.begin = 0;
+        worker->range.end = 0;
+
+        worker->errors = open_memstream(&worker->messages, &worker->messages_size);
+        if (!worker->errors) break;
+
+        init_vm(&worker->vm);
+        worker->vm.use_registers = use_registers;
+        worker->vm.errors = worker->errors;
+        pthread_mutex_init(&worker->range.lock, NULL);
+
+        if (pthread_create(&worker->thread, NULL, work, worker) != 0) {
+            pthread_mutex_destroy(&worker->range.lock);
+            free_vm(&worker->vm);
+            fclose(worker->errors);
+            free(worker->messages);
+            break;
+        }
+
+        pool->worker_count += 1;
+    }
+
+    if (pool->worker_count < worker_count) {
+        free_worker_pool(pool);
+        return false;
+    }
+
+    return true;
+}
+
+void free_worker_pool(WorkerPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->worker_count; i += 1) {
+        Worker* worker = &pool->workers[i];
+        pthread_join(worker->thread, NULL);
+
+        pthread_mutex_destroy(&worker->range.lock);
+        free_vm(&worker->vm);
+        fclose(worker->errors);
+        free(worker->messages);
+    }
+
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+
+    pool->workers = NULL;
+    pool->worker_count = 0;
+}
+
+void run_jobs(WorkerPool* pool, Job* jobs, size_t count) {
+    if (count == 0) return;
+
+    // The workers are all waiting, so their ranges can be set unlocked.
+    size_t workers = (size_t)pool->worker_count;
+    for (size_t i = 0; i < workers; i += 1) {
+        pool->workers[i].range.begin = count * i / workers;
+        pool->workers[i].range.end = count * (i + 1) / workers;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->jobs = jobs;
+    pool->busy = pool->worker_count;
+    pool->generation += 1;
+    pthread_cond_broadcast(&pool->work_ready);
+
+    while (pool->busy > 0) pthread_cond_wait(&pool->work_done, &pool->lock);
+    pool->jobs = NULL;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+const char* job_errors(WorkerPool* pool, const Job* job) {
+    return pool->workers[job->worker].messages + job->errors_start;
+}
+
+// Private
+
+static void* work(void* argument) {
+    Worker* worker = argument;
+    WorkerPool* pool = worker->pool;
+    uint64_t generation = 0;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stopping && pool->generation == generation) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->stopping) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        generation = pool->generation;
+        Job* jobs = pool->jobs;
+        pthread_mutex_unlock(&pool->lock);
+
+        fseek(worker->errors, 0, SEEK_SET);
+
+        size_t job;
+        while (take_job(worker, &job) || (steal_jobs(worker) && take_job(worker, &job))) {
+            run_job(worker, &jobs[job]);
+        }
+
+        // Brings messages up to date for job_errors().
+        fflush(worker->errors);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->busy -= 1;
+        if (pool->busy == 0) pthread_cond_signal(&pool->work_done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static bool take_job(Worker* worker, size_t* job) {
+    JobRange* range = &worker->range;
+    pthread_mutex_lock(&range->lock);
+
+    bool taken = range->begin < range->end;
+    if (taken) {
+        *job = range->begin;
+        range->begin += 1;
+    }
+
+    pthread_mutex_unlock(&range->lock);
+    return taken;
+}
+
+// Moves the back half of some other worker's range into this worker's empty
+// one. Fails once every range is empty. Jobs a thief has taken but not yet
+// stored are its own to run, so none are lost if others give up meanwhile.
+static bool steal_jobs(Worker* thief) {
+    WorkerPool* pool = thief->pool;
+
+    for (int i = 1; i < pool->worker_count; i += 1) {
+        Worker* victim = &pool->workers[(thief->index + i) % pool->worker_count];
+        JobRange* range = &victim->range;
+
+        pthread_mutex_lock(&range->lock);
+        size_t remaining = range->end - range->begin;
+        size_t begin = range->end - (remaining + 1) / 2;
+        size_t end = range->end;
+        range->end = begin;
+        pthread_mutex_unlock(&range->lock);
+
+        if (remaining == 0) continue;
+
+        pthread_mutex_lock(&thief->range.lock);
+        thief->range.begin = begin;
+        thief->range.end = end;
+        pthread_mutex_unlock(&thief->range.lock);
+        return true;
+    }
+
+    return false;
+}
+
+static void run_job(Worker* worker, Job* job) {
+    long start = ftell(worker->errors);
+
+    job->status = job->program ? lox_run(&worker->vm, job->program)
+                               : interpret(&worker->vm, job->source);
+    job->result = worker->vm.result;
+    job->worker = worker->index;
+    job->errors_start = (size_t)start;
+    job->errors_length = (size_t)(ftell(worker->errors) - start);
+}
@@ -0,0 +1,59 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_POOL_H
+#define LOX_POOL_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "program.h"
+#include "vm.h"
+
+// One source to compile and run, or a compiled program to run, and what
+// came of it.
+typedef struct {
+    const char* source;
+    const LoxProgram* program; // Run instead of source when not NULL.
+
+    InterpreterResult status;
+    Value result; // Valid when status is INTERPRET_OK.
+
+    // Where job_errors() finds the job's error messages.
+    int worker;
+    size_t errors_start;
+    size_t errors_length;
+} Job;
+
+typedef struct Worker Worker;
+
+// A fixed set of threads, each with its own VM, that share out the jobs of
+// every run_jobs() call. Jobs are independent: values carry no references,
+// so a result can be read from any thread.
+typedef struct {
+    int worker_count;
+    Worker* workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    uint64_t generation; // Bumped by every run_jobs() call.
+    int busy;            // Workers still on the current generation.
+    bool stopping;
+    Job* jobs;
+} WorkerPool;
+
+bool init_worker_pool(WorkerPool*, int worker_count, bool use_registers);
+void free_worker_pool(WorkerPool*);
+
+// Runs every job and returns once all of them are done. Each job's fields
+// other than source and program are filled in; the order jobs run in is
+// unspecified. Jobs may share a program.
+void run_jobs(WorkerPool*, Job*, size_t count);
+
+// The messages a failed job reported, not NUL-terminated; its length is
+// errors_length. Valid until the next run_jobs() on the pool.
+const char* job_errors(WorkerPool*, const Job*);
+
+#endif //LOX_POOL_H
@@ -0,0 +1,163 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <stdio.h>
+
+#include "profile.h"
+#include "debug.h"
+
+#define HOT_LINES 20
+
+typedef struct {
+    int line;
+    uint64_t count;
+    uint64_t cycles;
+} LineProfile;
+
+// Forward declarations
+
+static void print_opcodes(Profile*, Chunk*, uint64_t total);
+static void print_lines(Profile*, Chunk*, uint64_t total);
+static void print_listing(Profile*, Chunk*);
+static double percent(uint64_t part, uint64_t total);
+static int compare_line_numbers(const void*, const void*);
+static int compare_line_cycles(const void*, const void*);
+
+// Public
+
+bool init_profile(Profile* profile, Chunk* chunk) {
+    profile->counts = calloc(chunk->count, sizeof(uint64_t));
+    profile->cycles = calloc(chunk->count, sizeof(uint64_t));
+    profile->length = chunk->count;
+
+    if (!profile->counts || !profile->cycles) {
+        free_profile(profile);
+        return false;
+    }
+
+    return true;
+}
+
+void free_profile(Profile* profile) {
+    free(profile->counts);
+    free(profile->cycles);
+    profile->counts = NULL;
+    profile->cycles = NULL;
+    profile->length = 0;
+}
+
+void print_profile(Profile* profile, Chunk* chunk) {
+    uint64_t instructions = 0;
+    uint64_t total = 0;
+    for (int offset = 0; offset < profile->length; offset += 1) {
+        instructions += profile->counts[offset];
+        total += profile->cycles[offset];
+    }
+
+    printf("== profile: %llu instructions, %llu %s ==\n",
+           (unsigned long long)instructions, (unsigned long long)total, PROFILE_CLOCK_UNIT);
+
+    print_opcodes(profile, chunk, total);
+    print_lines(profile, chunk, total);
+    print_listing(profile, chunk);
+}
+
+// Private
+
+static void print_opcodes(Profile* profile, Chunk* chunk, uint64_t total) {
+    uint64_t counts[256] = {0};
+    uint64_t cycles[256] = {0};
+
+    for (int offset = 0; offset < profile->length; offset += 1) {
+        uint8_t opcode = chunk->code[offset];
+        counts[opcode] += profile->counts[offset];
+        cycles[opcode] += profile->cycles[offset];
+    }
+
+    printf("\n%-20s %12s %14s %7s %10s\n", "opcode", "count", PROFILE_CLOCK_UNIT, "time", "per op");
+
+    // Hottest first. There are few enough opcodes for a selection sort.
+    bool printed[256] = {false};
+    while (true) {
+        int hottest = -1;
+        for (int opcode = 0; opcode < 256; opcode += 1) {
+            if (printed[opcode] || counts[opcode] == 0) continue;
+            if (hottest < 0 || cycles[opcode] > cycles[hottest]) hottest = opcode;
+        }
+        if (hottest < 0) break;
+
+        printed[hottest] = true;
+        printf("%-20s %12llu %14llu %6.2f%% %10.1f\n", opcode_name((uint8_t)hottest),
+               (unsigned long long)counts[hottest], (unsigned long long)cycles[hottest],
+               percent(cycles[hottest], total), (double)cycles[hottest] / counts[hottest]);
+    }
+}
+
+static void print_lines(Profile* profile, Chunk* chunk, uint64_t total) {
+    LineProfile* lines = calloc(chunk->line_count, sizeof(LineProfile));
+    if (!lines) return;
+
+    // One entry per run of the line table, then runs of the same line merged.
+    for (int i = 0; i < chunk->line_count; i += 1) {
+        int end = i + 1 < chunk->line_count ? chunk->lines[i + 1].offset : chunk->count;
+        lines[i].line = chunk->lines[i].line;
+
+        for (int offset = chunk->lines[i].offset; offset < end; offset += 1) {
+            lines[i].count += profile->counts[offset];
+            lines[i].cycles += profile->cycles[offset];
+        }
+    }
+
+    qsort(lines, chunk->line_count, sizeof(LineProfile), compare_line_numbers);
+
+    int count = 0;
+    for (int i = 0; i < chunk->line_count; i += 1) {
+        if (count > 0 && lines[count - 1].line == lines[i].line) {
+            lines[count - 1].count += lines[i].count;
+            lines[count - 1].cycles += lines[i].cycles;
+        } else {
+            lines[count] = lines[i];
+            count += 1;
+        }
+    }
+
+    qsort(lines, count, sizeof(LineProfile), compare_line_cycles);
+
+    printf("\n%-20s %12s %14s %7s\n", "line", "count", PROFILE_CLOCK_UNIT, "time");
+    for (int i = 0; i < count && i < HOT_LINES; i += 1) {
+        if (lines[i].count == 0) break;
+
+        printf("%-20d %12llu %14llu %6.2f%%\n", lines[i].line,
+               (unsigned long long)lines[i].count, (unsigned long long)lines[i].cycles,
+               percent(lines[i].cycles, total));
+    }
+
+    free(lines);
+}
+
+static void print_listing(Profile* profile, Chunk* chunk) {
+    printf("\n%12s %14s  listing\n", "count", PROFILE_CLOCK_UNIT);
+
+    for (int offset = 0; offset < chunk->count;) {
+        printf("%12llu %14llu  ",
+               (unsigned long long)profile->counts[offset], (unsigned long long)profile->cycles[offset]);
+        offset = dissasemble_instruction(chunk, offset);
+    }
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total == 0 ? 0.0 : 100.0 * (double)part / (double)total;
+}
+
+static int compare_line_numbers(const void* a, const void* b) {
+    int left = ((const LineProfile*)a)->line;
+    int right = ((const LineProfile*)b)->line;
+    return (left > right) - (left < right);
+}
+
+static int compare_line_cycles(const void* a, const void* b) {
+    uint64_t left = ((const LineProfile*)a)->cycles;
+    uint64_t right = ((const LineProfile*)b)->cycles;
+    return (left < right) - (left > right);
+}
@@ -0,0 +1,43 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_PROFILE_H
+#define LOX_PROFILE_H
+
+#include "chunk.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_CLOCK_UNIT "cycles"
+#else
+#include <time.h>
+#define PROFILE_CLOCK_UNIT "ns"
+#endif
+
+// Execution counts and elapsed time for every instruction of one chunk,
+// indexed by code offset. Per-opcode and per-line figures are summed from
+// these when the report is printed.
+typedef struct {
+    uint64_t* counts;
+    uint64_t* cycles;
+    int length; // The chunk's code count.
+} Profile;
+
+bool init_profile(Profile*, Chunk*);
+void free_profile(Profile*);
+
+// Prints the hot opcode and line tables followed by the annotated listing.
+void print_profile(Profile*, Chunk*);
+
+static inline uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+#endif //LOX_PROFILE_H
@@ -0,0 +1,128 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+#include "compiler.h"
+#include "jit.h"
+#include "memory.h"
+#include "regvm.h"
+
+// Ids start at one; zero marks an empty ProgramCode slot.
+static uint64_t last_program_id = 0;
+
+// Forward declarations
+
+static ProgramCode* private_code(VM*, const LoxProgram*);
+
+// Public
+
+bool init_program(LoxProgram* program, const char* source, Arena* arena, FILE* errors) {
+    program->id = 0;
+    init_chunk(&program->chunk, arena);
+
+    if (!compile(source, &program->chunk, errors)) {
+        free_chunk(&program->chunk);
+        return false;
+    }
+
+    return true;
+}
+
+LoxProgram* lox_compile(const char* source, FILE* errors) {
+    LoxProgram* program = malloc(sizeof(LoxProgram));
+    if (!program) return NULL;
+
+    if (!init_program(program, source, NULL, errors)) {
+        free(program);
+        return NULL;
+    }
+
+    // Only programs that can be shared need an id for VMs to key copies by.
+    program->id = __atomic_add_fetch(&last_program_id, 1, __ATOMIC_RELAXED);
+    return program;
+}
+
+void lox_free_program(LoxProgram* program) {
+    if (!program) return;
+
+    free_chunk(&program->chunk);
+    free(program);
+}
+
+InterpreterResult lox_run(VM* vm, const LoxProgram* program) {
+    // Drop whatever the previous call left behind in one go.
+    reset_arena(&vm->arena);
+
+    // Everything but the code is only read while running.
+    ProgramCode* slot = private_code(vm, program);
+    Chunk chunk = program->chunk;
+    chunk.code = slot->code;
+    chunk.runs = slot->runs;
+    chunk.jit = slot->jit;
+    chunk.registers = slot->registers;
+
+    InterpreterResult result = interpret_chunk(vm, &chunk);
+
+    // The run was counted, and may have compiled or translated the code.
+    slot->runs = chunk.runs;
+    slot->jit = chunk.jit;
+    slot->registers = chunk.registers;
+    return result;
+}
+
+void free_program_code(VM* vm) {
+    if (!vm->program_code) return;
+
+    for (int i = 0; i < PROGRAM_CODE_SLOTS; i += 1) {
+        ProgramCode* slot = &vm->program_code[i];
+        FREE_ARRAY(NULL, MEMORY_SITE_CODE, uint8_t, slot->code, slot->count);
+        free_jit(slot->jit);
+        free_translation(slot->registers);
+    }
+
+    FREE_ARRAY(NULL, MEMORY_SITE_CODE, ProgramCode, vm->program_code, PROGRAM_CODE_SLOTS);
+    vm->program_code = NULL;
+}
+
+// Private
+
+// The copy quickened by earlier runs of the same program, or a fresh one
+// that takes over the least recently run slot of the program's set.
+static ProgramCode* private_code(VM* vm, const LoxProgram* program) {
+    if (!vm->program_code) {
+        vm->program_code = GROW_ARRAY(NULL, MEMORY_SITE_CODE, ProgramCode, NULL, 0, PROGRAM_CODE_SLOTS);
+        memset(vm->program_code, 0, sizeof(ProgramCode) * PROGRAM_CODE_SLOTS);
+    }
+
+    ProgramCode* set = &vm->program_code[program->id % PROGRAM_CODE_SETS * PROGRAM_CODE_WAYS];
+    ProgramCode* slot = &set[0];
+    for (int way = 0; way < PROGRAM_CODE_WAYS; way += 1) {
+        if (set[way].program == program->id) {
+            slot = &set[way];
+            break;
+        }
+        if (set[way].last_run < slot->last_run) slot = &set[way];
+    }
+
+    if (slot->program != program->id) {
+        slot->code = GROW_ARRAY(NULL, MEMORY_SITE_CODE, uint8_t, slot->code, slot->count,
+                                program->chunk.count);
+        memcpy(slot->code, program->chunk.code, (size_t)program->chunk.count);
+        slot->program = program->id;
+        slot->count = program->chunk.count;
+
+        free_jit(slot->jit);
+        free_translation(slot->registers);
+        slot->runs = 0;
+        slot->jit = NULL;
+        slot->registers = NULL;
+    }
+
+    vm->program_runs += 1;
+    slot->last_run = vm->program_runs;
+    return slot;
+}
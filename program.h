@@ -0,0 +1,35 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_PROGRAM_H
+#define LOX_PROGRAM_H
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "vm.h"
+
+// A compiled source, to be run any number of times by any number of VMs.
+// Nothing writes to it after lox_compile(), so threads can share one.
+typedef struct {
+    uint64_t id; // Unique for the life of the process, never zero.
+    Chunk chunk; // On the heap, outside any VM's arena.
+} LoxProgram;
+
+// Compiles into chunk arrays allocated from arena, or the heap when it is
+// NULL. The program gets no id, so it is for the caller alone to run.
+bool init_program(LoxProgram*, const char* source, Arena*, FILE* errors);
+
+// Returns NULL when the source does not compile; errors go to the stream.
+LoxProgram* lox_compile(const char* source, FILE* errors);
+void lox_free_program(LoxProgram*);
+
+// Runs the program on the VM. The VM quickens a private copy of the code,
+// kept while it runs the same program again, so the program stays unchanged.
+InterpreterResult lox_run(VM*, const LoxProgram*);
+
+// Frees the VM's program copies. Called by free_vm().
+void free_program_code(VM*);
+
+#endif //LOX_PROGRAM_H
@@ -0,0 +1,329 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "regvm.h"
+#include "memory.h"
+
+// Translation walks the stack code once, keeping a symbolic stack of the
+// operand each slot holds. The code the compiler emits is straight-line, so
+// every instruction sees the same depth on every run, and the slot a result
+// lands in can serve as its register. Constant loads only push their
+// operand; operators emit one instruction that reads the operands it pops.
+
+// Forward declarations
+
+static void emit(RegChunk*, RegOpCode, int dst, int a, int b, int line);
+static InterpreterResult execute(VM*, RegChunk*);
+static RegInstruction* overflowing_instruction(RegChunk*);
+static void runtime_error(VM*, RegChunk*, RegInstruction*, const char* format, ...);
+
+// Public
+
+void init_reg_chunk(RegChunk* chunk, Arena* arena) {
+    chunk->capacity = 0;
+    chunk->count = 0;
+    chunk->code = NULL;
+    chunk->lines = NULL;
+    init_value_array(&chunk->constants, arena);
+    chunk->register_count = 0;
+    chunk->arena = arena;
+}
+
+void free_reg_chunk(RegChunk* chunk) {
+    FREE_ARRAY(chunk->arena, MEMORY_SITE_REGISTERS, RegInstruction, chunk->code, chunk->capacity);
+    FREE_ARRAY(chunk->arena, MEMORY_SITE_REGISTERS, int, chunk->lines, chunk->capacity);
+    free_value_array(&chunk->constants);
+    init_reg_chunk(chunk, chunk->arena);
+}
+
+bool translate_chunk(Chunk* chunk, RegChunk* reg) {
+    for (int i = 0; i < chunk->constants.count; i += 1) {
+        write_value_array(&reg->constants, chunk->constants.values[i]);
+    }
+
+    // nil, true and false are loaded by their own opcodes on the stack, and
+    // are plain constants here.
+    int nil_constant = reg->constants.count;
+    write_value_array(&reg->constants, NIL_VAL);
+    write_value_array(&reg->constants, BOOL_VAL(true));
+    write_value_array(&reg->constants, BOOL_VAL(false));
+
+    int registers = reg->constants.count;
+    if (registers > REG_FRAME_MAX || registers > STACK_MAX) return false;
+
+    // Depth never exceeds the number of instructions.
+    int* stack = GROW_ARRAY(reg->arena, MEMORY_SITE_REGISTERS, int, NULL, 0, chunk->count + 1);
+    int depth = 0;
+    bool ok = false;
+
+    for (int offset = 0; offset < chunk->count;) {
+        // A chunk that already ran may hold quickened instructions.
+        OpCode instruction = generic_opcode(chunk->code[offset]);
+        int line = get_line(chunk, offset);
+        offset += 1;
+
+        switch (instruction) {
+            case OP_CONSTANT:
+                stack[depth++] = chunk->code[offset];
+                offset += 1;
+                continue;
+            case OP_CONSTANT_LONG:
+                stack[depth++] = chunk->code[offset] |
+                                 (chunk->code[offset + 1] << 8) |
+                                 (chunk->code[offset + 2] << 16);
+                offset += 3;
+                continue;
+            case OP_NIL:   stack[depth++] = nil_constant; continue;
+            case OP_TRUE:  stack[depth++] = nil_constant + 1; continue;
+            case OP_FALSE: stack[depth++] = nil_constant + 2; continue;
+            default:
+                break;
+        }
+
+        RegOpCode op;
+        int arity = 2;
+        switch (instruction) {
+            case OP_EQUAL:         op = REG_EQUAL; break;
+            case OP_NOT_EQUAL:     op = REG_NOT_EQUAL; break;
+            case OP_GREATER:       op = REG_GREATER; break;
+            case OP_GREATER_EQUAL: op = REG_GREATER_EQUAL; break;
+            case OP_LESS:          op = REG_LESS; break;
+            case OP_LESS_EQUAL:    op = REG_LESS_EQUAL; break;
+            case OP_ADD:      op = REG_ADD; break;
+            case OP_SUBTRACT: op = REG_SUBTRACT; break;
+            case OP_MULTIPLY: op = REG_MULTIPLY; break;
+            case OP_DIVIDE:   op = REG_DIVIDE; break;
+            case OP_NOT:      op = REG_NOT; arity = 1; break;
+            case OP_NEGATE:   op = REG_NEGATE; arity = 1; break;
+            case OP_RETURN:   op = REG_RETURN; arity = 1; break;
+            default:
+                goto done;
+        }
+
+        if (depth < arity) goto done;
+        depth -= arity;
+
+        int a = stack[depth];
+        int b = arity == 2 ? stack[depth + 1] : 0;
+
+        if (op == REG_RETURN) {
+            emit(reg, op, 0, a, 0, line);
+            ok = offset == chunk->count;
+            goto done;
+        }
+
+        // The result takes the register of the slot the first operand was in.
+        // A chunk that would overflow the frame goes to the stack VM, which
+        // reports the overflow where it happens.
+        int dst = registers + depth;
+        if (dst >= REG_FRAME_MAX || dst >= STACK_MAX) goto done;
+
+        emit(reg, op, dst, a, b, line);
+        stack[depth] = dst;
+        depth += 1;
+        if (depth > reg->register_count) reg->register_count = depth;
+    }
+
+done:
+    FREE_ARRAY(reg->arena, MEMORY_SITE_REGISTERS, int, stack, chunk->count + 1);
+    return ok;
+}
+
+RegChunk* translation_for(Chunk* chunk) {
+    if (!chunk->registers) {
+        chunk->registers = GROW_ARRAY(chunk->arena, MEMORY_SITE_REGISTERS, RegChunk, NULL, 0, 1);
+        init_reg_chunk(chunk->registers, chunk->arena);
+
+        // An empty translation stands for one that failed.
+        if (!translate_chunk(chunk, chunk->registers)) free_reg_chunk(chunk->registers);
+    }
+
+    return chunk->registers->count > 0 ? chunk->registers : NULL;
+}
+
+void free_translation(RegChunk* chunk) {
+    if (!chunk) return;
+
+    free_reg_chunk(chunk);
+    FREE_ARRAY(chunk->arena, MEMORY_SITE_REGISTERS, RegChunk, chunk, 1);
+}
+
+InterpreterResult run_registers(VM* vm, RegChunk* chunk) {
+    enter_value_stack(&vm->stack);
+
+    // translate_chunk() keeps the frame within STACK_MAX, but a stale jump
+    // buffer must never be left for the fault handler.
+    if (sigsetjmp(vm->stack.overflow, 0)) {
+        runtime_error(vm, chunk, overflowing_instruction(chunk), "Stack overflow.");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    return execute(vm, chunk);
+}
+
+// Private
+
+static void emit(RegChunk* chunk, RegOpCode op, int dst, int a, int b, int line) {
+    if (chunk->capacity < chunk->count + 1) {
+        int old_capacity = chunk->capacity;
+        chunk->capacity = GROW_CAPACITY(old_capacity);
+        chunk->code = GROW_ARRAY(chunk->arena, MEMORY_SITE_REGISTERS, RegInstruction,
+                                 chunk->code, old_capacity, chunk->capacity);
+        chunk->lines = GROW_ARRAY(chunk->arena, MEMORY_SITE_REGISTERS, int,
+                                  chunk->lines, old_capacity, chunk->capacity);
+    }
+
+    RegInstruction* instruction = &chunk->code[chunk->count];
+    instruction->op = (uint8_t)op;
+    instruction->dst = (uint16_t)dst;
+    instruction->a = (uint16_t)a;
+    instruction->b = (uint16_t)b;
+    chunk->lines[chunk->count] = line;
+    chunk->count += 1;
+}
+
+static InterpreterResult execute(VM* vm, RegChunk* chunk) {
+    // Constants at the bottom of the VM stack, registers right above them.
+    Value* frame = vm->stack.values;
+    memcpy(frame, chunk->constants.values, sizeof(Value) * chunk->constants.count);
+
+    RegInstruction* ip = chunk->code;
+    RegInstruction* instruction;
+
+#define RUNTIME_ERROR(...)                                  \
+    do {                                                    \
+        runtime_error(vm, chunk, instruction, __VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR;                     \
+    } while (false)
+#define BINARY_OP(value_type, op)                                 \
+    do {                                                          \
+        Value a = frame[instruction->a];                          \
+        Value b = frame[instruction->b];                          \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                     \
+            RUNTIME_ERROR("Operands must be numbers.");           \
+        }                                                         \
+        frame[instruction->dst] = value_type(AS_NUMBER(a) op AS_NUMBER(b)); \
+    } while (false)
+// Lox defines a >= b as !(a < b) and a <= b as !(a > b).
+#define NEGATED_COMPARISON_OP(op)                                 \
+    do {                                                          \
+        Value a = frame[instruction->a];                          \
+        Value b = frame[instruction->b];                          \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                     \
+            RUNTIME_ERROR("Operands must be numbers.");           \
+        }                                                         \
+        frame[instruction->dst] = BOOL_VAL(!(AS_NUMBER(a) op AS_NUMBER(b))); \
+    } while (false)
+
+#ifdef COMPUTED_GOTO
+    static void* const dispatch_table[] = {
+        [REG_ADD]           = &&do_REG_ADD,
+        [REG_SUBTRACT]      = &&do_REG_SUBTRACT,
+        [REG_MULTIPLY]      = &&do_REG_MULTIPLY,
+        [REG_DIVIDE]        = &&do_REG_DIVIDE,
+        [REG_EQUAL]         = &&do_REG_EQUAL,
+        [REG_NOT_EQUAL]     = &&do_REG_NOT_EQUAL,
+        [REG_GREATER]       = &&do_REG_GREATER,
+        [REG_GREATER_EQUAL] = &&do_REG_GREATER_EQUAL,
+        [REG_LESS]          = &&do_REG_LESS,
+        [REG_LESS_EQUAL]    = &&do_REG_LESS_EQUAL,
+        [REG_NOT]           = &&do_REG_NOT,
+        [REG_NEGATE]        = &&do_REG_NEGATE,
+        [REG_RETURN]        = &&do_REG_RETURN,
+    };
+
+#define DISPATCH()                                      \
+    do {                                                \
+        instruction = ip++;                             \
+        goto *dispatch_table[instruction->op];          \
+    } while (false)
+#define CASE(opcode) do_##opcode:
+#define NEXT() DISPATCH()
+
+    DISPATCH();
+#else
+#define CASE(opcode) case opcode:
+#define NEXT() break
+
+    while (true) {
+        instruction = ip++;
+
+        switch (instruction->op) {
+#endif
+            CASE(REG_ADD)      BINARY_OP(NUMBER_VAL, +); NEXT();
+            CASE(REG_SUBTRACT) BINARY_OP(NUMBER_VAL, -); NEXT();
+            CASE(REG_MULTIPLY) BINARY_OP(NUMBER_VAL, *); NEXT();
+            CASE(REG_DIVIDE)   BINARY_OP(NUMBER_VAL, /); NEXT();
+
+            CASE(REG_EQUAL) {
+                frame[instruction->dst] =
+                    BOOL_VAL(values_equal(frame[instruction->a], frame[instruction->b]));
+                NEXT();
+            }
+            CASE(REG_NOT_EQUAL) {
+                frame[instruction->dst] =
+                    BOOL_VAL(!values_equal(frame[instruction->a], frame[instruction->b]));
+                NEXT();
+            }
+
+            CASE(REG_GREATER)       BINARY_OP(BOOL_VAL, >); NEXT();
+            CASE(REG_GREATER_EQUAL) NEGATED_COMPARISON_OP(<); NEXT();
+            CASE(REG_LESS)          BINARY_OP(BOOL_VAL, <); NEXT();
+            CASE(REG_LESS_EQUAL)    NEGATED_COMPARISON_OP(>); NEXT();
+
+            CASE(REG_NOT) {
+                frame[instruction->dst] = BOOL_VAL(is_falsey(frame[instruction->a]));
+                NEXT();
+            }
+            CASE(REG_NEGATE) {
+                Value a = frame[instruction->a];
+                if (!IS_NUMBER(a)) {
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+                frame[instruction->dst] = NUMBER_VAL(-AS_NUMBER(a));
+                NEXT();
+            }
+            CASE(REG_RETURN) {
+                vm->result = frame[instruction->a];
+                return INTERPRET_OK;
+            }
+#ifndef COMPUTED_GOTO
+        }
+    }
+#endif
+
+#undef NEXT
+#undef CASE
+#undef DISPATCH
+#undef NEGATED_COMPARISON_OP
+#undef BINARY_OP
+#undef RUNTIME_ERROR
+}
+
+// The first instruction writing a register past the end of the stack.
+static RegInstruction* overflowing_instruction(RegChunk* chunk) {
+    for (int i = 0; i < chunk->count; i += 1) {
+        RegInstruction* instruction = &chunk->code[i];
+        int dst = instruction->dst;
+        if (instruction->op != REG_RETURN && dst >= STACK_MAX) return instruction;
+    }
+
+    return chunk->code;
+}
+
+static void runtime_error(VM* vm, RegChunk* chunk, RegInstruction* instruction,
+                          const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(vm->errors, format, args);
+    va_end(args);
+    fputs("\n", vm->errors);
+
+    int line = chunk->lines[instruction - chunk->code];
+    fprintf(vm->errors, "[line %d] in script\n", line);
+}
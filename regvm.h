@@ -0,0 +1,67 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_REGVM_H
+#define LOX_REGVM_H
+
+#include "chunk.h"
+#include "vm.h"
+
+// A three-address form of a stack chunk. Each stack slot becomes a
+// register, and loads disappear: constants are operands in their own right.
+typedef enum {
+    REG_ADD,
+    REG_SUBTRACT,
+    REG_MULTIPLY,
+    REG_DIVIDE,
+    REG_EQUAL,
+    REG_NOT_EQUAL,
+    REG_GREATER,
+    REG_GREATER_EQUAL,
+    REG_LESS,
+    REG_LESS_EQUAL,
+    REG_NOT,       // dst = !a
+    REG_NEGATE,    // dst = -a
+    REG_RETURN,    // result = a
+} RegOpCode;
+
+// Operands index one frame: the constants first, then the registers, so an
+// operand needs no tag to say which kind it is. 16-bit operands keep an
+// instruction at 8 bytes; chunks whose frame would not fit stay on the stack.
+#define REG_FRAME_MAX (UINT16_MAX + 1)
+
+typedef struct {
+    uint8_t op;
+    uint16_t dst;
+    uint16_t a;
+    uint16_t b;
+} RegInstruction;
+
+struct RegChunk {
+    int capacity;
+    int count;
+    RegInstruction* code;
+    int* lines; // One per instruction.
+
+    ValueArray constants; // Copied into the bottom of the frame on every run.
+    int register_count;
+    Arena* arena;
+};
+
+void init_reg_chunk(RegChunk*, Arena*);
+void free_reg_chunk(RegChunk*);
+
+// Fails when the chunk does not have the shape the compiler produces, or
+// needs a frame larger than REG_FRAME_MAX.
+bool translate_chunk(Chunk*, RegChunk*);
+
+// The chunk's translation, made by the first call and kept in
+// chunk->registers for the rest. NULL when the chunk does not translate,
+// which the first call also remembers.
+RegChunk* translation_for(Chunk*);
+void free_translation(RegChunk*);
+
+InterpreterResult run_registers(VM*, RegChunk*);
+
+#endif //LOX_REGVM_H
@@ -6,9 +6,97 @@
 
 #include "scanner.h"
 #include "common.h"
+#include "memory.h"
+#include "number.h"
+
+// Every byte of source is classified through one table lookup instead of a
+// chain of range checks.
+typedef enum {
+    CHAR_OTHER,    // Not valid outside strings and comments.
+    CHAR_END,      // The NUL terminator.
+    CHAR_ALPHA,    // Starts an identifier or keyword.
+    CHAR_DIGIT,    // Starts a number.
+    CHAR_BLANK,    // Skipped before each token.
+    CHAR_SINGLE,   // A token on its own.
+    CHAR_EQUALS,   // A token on its own or followed by '='.
+    CHAR_QUOTE,    // Starts a string.
+} CharClass;
+
+#define __ CHAR_OTHER
+#define EN CHAR_END
+#define AL CHAR_ALPHA
+#define DI CHAR_DIGIT
+#define BL CHAR_BLANK
+#define SI CHAR_SINGLE
+#define EQ CHAR_EQUALS
+#define QU CHAR_QUOTE
+
+// Bytes from 0x80 up are all CHAR_OTHER.
+static const uint8_t char_classes[256] = {
+    /* 0_ */ EN, __, __, __, __, __, __, __, __, BL, BL, __, __, BL, __, __,
+    /* 1_ */ __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
+    /* 2_ */ BL, EQ, QU, __, __, __, __, __, SI, SI, SI, SI, SI, SI, SI, SI,
+    /* 3_ */ DI, DI, DI, DI, DI, DI, DI, DI, DI, DI, __, SI, EQ, EQ, EQ, __,
+    /* 4_ */ __, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL,
+    /* 5_ */ AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, __, __, __, __, AL,
+    /* 6_ */ __, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL,
+    /* 7_ */ AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, AL, SI, __, SI, __, __,
+};
+
+#undef __
+#undef EN
+#undef AL
+#undef DI
+#undef BL
+#undef SI
+#undef EQ
+#undef QU
+
+static const uint8_t single_tokens[128] = {
+    ['('] = TOKEN_LEFT_PAREN,
+    [')'] = TOKEN_RIGHT_PAREN,
+    ['{'] = TOKEN_LEFT_BRACE,
+    ['}'] = TOKEN_RIGHT_BRACE,
+    [';'] = TOKEN_SEMICOLON,
+    [','] = TOKEN_COMMA,
+    ['.'] = TOKEN_DOT,
+    ['-'] = TOKEN_MINUS,
+    ['+'] = TOKEN_PLUS,
+    ['/'] = TOKEN_SLASH,
+    ['*'] = TOKEN_STAR,
+};
+
+// The token for each CHAR_EQUALS byte alone, and followed by '='.
+static const uint8_t equals_tokens[128][2] = {
+    ['!'] = { TOKEN_BANG,    TOKEN_BANG_EQUAL },
+    ['='] = { TOKEN_EQUAL,   TOKEN_EQUAL_EQUAL },
+    ['<'] = { TOKEN_LESS,    TOKEN_LESS_EQUAL },
+    ['>'] = { TOKEN_GREATER, TOKEN_GREATER_EQUAL },
+};
+
+// Indexed by Scanner.error.
+static const char* const error_messages[] = {
+    "Unexpected character",
+    "Unterminated string.",
+};
+
+typedef enum {
+    ERROR_UNEXPECTED_CHARACTER,
+    ERROR_UNTERMINATED_STRING,
+} ScanError;
+
+// A number literal's digits as they are scanned.
+typedef struct {
+    uint64_t mantissa;
+    int digits;     // Significant digits in mantissa, leading zeros aside.
+    int exponent;   // Power of ten to scale mantissa by.
+    bool truncated; // More digits than mantissa holds.
+} DecimalNumber;
 
 // Forward declarations
 
+static TokenType next_token(Scanner*);
+
 static bool is_at_end(Scanner*);
 static bool match(Scanner*, char expected);
 static void skip_whitespace(Scanner*);
@@ -16,60 +104,110 @@ static char peek(Scanner*);
 static char peek_next(Scanner*);
 
 static bool is_digit(char);
-static bool is_alpha(char);
 
 static Token make_token(Scanner*, TokenType);
-static Token error_token(Scanner*, const char* message);
+static TokenType error(Scanner*, ScanError);
 static TokenType identifier_type(Scanner*);
 
-static Token string(Scanner*);
-static Token number(Scanner*);
-static Token identifier(Scanner*);
+static TokenType string(Scanner*);
+static TokenType number(Scanner*);
+static TokenType identifier(Scanner*);
+
+static void scan_digits(Scanner*, DecimalNumber*, bool fraction);
+
+static void grow_token_buffer(TokenBuffer*, int capacity);
+static void push_token(TokenBuffer*, TokenType, int offset, int length, int line);
 
 static char advance(Scanner* scanner);
 
 // Public
 
 void init_scanner(Scanner* scanner, const char* source) {
+    init_scanner_with_kernels(scanner, source, scan_kernels(SCAN_KERNEL_AUTO));
+}
+
+void init_scanner_with_kernels(Scanner* scanner, const char* source, const ScanKernels* kernels) {
     scanner->start = source;
     scanner->current = source;
     scanner->line = 1;
+    scanner->error = 0;
+    scanner->number = 0;
+    scanner->kernels = kernels;
 }
 
 Token scan_token(Scanner* scanner) {
-    skip_whitespace(scanner);
+    return make_token(scanner, next_token(scanner));
+}
 
-    scanner->start = scanner->current;
+void init_token_buffer(TokenBuffer* buffer, Arena* arena) {
+    buffer->capacity = 0;
+    buffer->count = 0;
+    buffer->types = NULL;
+    buffer->offsets = NULL;
+    buffer->lengths = NULL;
+    buffer->lines = NULL;
+    buffer->numbers = NULL;
+    buffer->source = NULL;
+    buffer->arena = arena;
+}
 
-    if (is_at_end(scanner)) return make_token(scanner, TOKEN_EOF);
+void free_token_buffer(TokenBuffer* buffer) {
+    FREE_ARRAY(buffer->arena, MEMORY_SITE_TOKENS, uint8_t, buffer->types, buffer->capacity);
+    FREE_ARRAY(buffer->arena, MEMORY_SITE_TOKENS, int, buffer->offsets, buffer->capacity);
+    FREE_ARRAY(buffer->arena, MEMORY_SITE_TOKENS, int, buffer->lengths, buffer->capacity);
+    FREE_ARRAY(buffer->arena, MEMORY_SITE_TOKENS, int, buffer->lines, buffer->capacity);
+    FREE_ARRAY(buffer->arena, MEMORY_SITE_TOKENS, double, buffer->numbers, buffer->capacity);
+    init_token_buffer(buffer, buffer->arena);
+}
 
-    char c = advance(scanner);
+void tokenize(TokenBuffer* buffer, const char* source) {
+    Scanner scanner;
+    init_scanner(&scanner, source);
+    buffer->source = source;
+
+    // Real code averages a token every few bytes; sizing for that up front
+    // avoids regrowing five arrays while scanning.
+    int estimate = (int)(strlen(source) / 4) + 1;
+    if (buffer->capacity < estimate) grow_token_buffer(buffer, estimate);
+
+    while (true) {
+        TokenType type = next_token(&scanner);
+
+        if (type == TOKEN_ERROR) {
+            push_token(buffer, type, scanner.error, 0, scanner.line);
+        } else if (type == TOKEN_NUMBER) {
+            push_token(buffer, type,
+                       (int)(scanner.start - source),
+                       (int)(scanner.current - scanner.start),
+                       scanner.line);
+            buffer->numbers[buffer->count - 1] = scanner.number;
+        } else {
+            push_token(buffer, type,
+                       (int)(scanner.start - source),
+                       (int)(scanner.current - scanner.start),
+                       scanner.line);
+        }
 
-    if (is_alpha(c)) return identifier(scanner);
-    if (is_digit(c)) return number(scanner);
+        if (type == TOKEN_EOF) return;
+    }
+}
 
-    switch (c) {
-        case '(': return make_token(scanner, TOKEN_LEFT_PAREN);
-        case ')': return make_token(scanner, TOKEN_RIGHT_PAREN);
-        case '{': return make_token(scanner, TOKEN_LEFT_BRACE);
-        case '}': return make_token(scanner, TOKEN_RIGHT_BRACE);
-        case ';': return make_token(scanner, TOKEN_SEMICOLON);
-        case ',': return make_token(scanner, TOKEN_COMMA);
-        case '.': return make_token(scanner, TOKEN_DOT);
-        case '-': return make_token(scanner, TOKEN_MINUS);
-        case '+': return make_token(scanner, TOKEN_PLUS);
-        case '/': return make_token(scanner, TOKEN_SLASH);
-        case '*': return make_token(scanner, TOKEN_STAR);
+Token token_at(TokenBuffer* buffer, int index) {
+    Token token = {
+        .type = (TokenType)buffer->types[index],
+        .start = buffer->source + buffer->offsets[index],
+        .length = buffer->lengths[index],
+        .line = buffer->lines[index],
+    };
 
-        case '!': return make_token(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL    : TOKEN_BANG);
-        case '=': return make_token(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL   : TOKEN_EQUAL);
-        case '<': return make_token(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL    : TOKEN_LESS);
-        case '>': return make_token(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+    if (token.type == TOKEN_NUMBER) token.number = buffer->numbers[index];
 
-        case '"': return string(scanner);
+    if (token.type == TOKEN_ERROR) {
+        token.start = error_messages[buffer->offsets[index]];
+        token.length = (int)strlen(token.start);
     }
 
-    return error_token(scanner, "Unexpected character");
+    return token;
 }
 
 static char advance(Scanner* scanner) {
@@ -79,30 +217,91 @@ static char advance(Scanner* scanner) {
 
 // Private
 
+// Scans the next token into [start, current) and returns its type. Shared by
+// scan_token and tokenize so that both read the same tables.
+static TokenType next_token(Scanner* scanner) {
+    skip_whitespace(scanner);
+
+    scanner->start = scanner->current;
+
+    unsigned char c = (unsigned char)*scanner->current;
+    switch (char_classes[c]) {
+        case CHAR_END:
+            return TOKEN_EOF;
+        case CHAR_ALPHA:
+            advance(scanner);
+            return identifier(scanner);
+        case CHAR_DIGIT:
+            advance(scanner);
+            return number(scanner);
+        case CHAR_SINGLE:
+            advance(scanner);
+            return (TokenType)single_tokens[c];
+        case CHAR_EQUALS:
+            advance(scanner);
+            return (TokenType)equals_tokens[c][match(scanner, '=')];
+        case CHAR_QUOTE:
+            advance(scanner);
+            return string(scanner);
+        default:
+            advance(scanner);
+            return error(scanner, ERROR_UNEXPECTED_CHARACTER);
+    }
+}
+
+static void grow_token_buffer(TokenBuffer* buffer, int capacity) {
+    int old_capacity = buffer->capacity;
+    buffer->capacity = capacity;
+    buffer->types = GROW_ARRAY(buffer->arena, MEMORY_SITE_TOKENS, uint8_t, buffer->types, old_capacity, capacity);
+    buffer->offsets = GROW_ARRAY(buffer->arena, MEMORY_SITE_TOKENS, int, buffer->offsets, old_capacity, capacity);
+    buffer->lengths = GROW_ARRAY(buffer->arena, MEMORY_SITE_TOKENS, int, buffer->lengths, old_capacity, capacity);
+    buffer->lines = GROW_ARRAY(buffer->arena, MEMORY_SITE_TOKENS, int, buffer->lines, old_capacity, capacity);
+    buffer->numbers = GROW_ARRAY(buffer->arena, MEMORY_SITE_TOKENS, double, buffer->numbers, old_capacity, capacity);
+}
+
+static void push_token(TokenBuffer* buffer, TokenType type, int offset, int length, int line) {
+    if (buffer->capacity < buffer->count + 1) {
+        grow_token_buffer(buffer, GROW_CAPACITY(buffer->capacity));
+    }
+
+    buffer->types[buffer->count] = (uint8_t)type;
+    buffer->offsets[buffer->count] = offset;
+    buffer->lengths[buffer->count] = length;
+    buffer->lines[buffer->count] = line;
+    buffer->count += 1;
+}
+
 static bool is_at_end(Scanner* scanner) {
     return *scanner->current == '\0';
 }
 
 static Token make_token(Scanner* scanner, TokenType type) {
+    if (type == TOKEN_ERROR) {
+        const char* message = error_messages[scanner->error];
+        Token token = {
+            .type = TOKEN_ERROR,
+            .start = message,
+            .length = (int) strlen(message),
+            .line = scanner->line
+        };
+
+        return token;
+    }
+
     Token token = {
         .type = type,
         .start = scanner->start,
         .length = (int)(scanner->current - scanner->start),
-        .line = scanner->line
+        .line = scanner->line,
+        .number = type == TOKEN_NUMBER ? scanner->number : 0,
     };
 
     return token;
 }
 
-static Token error_token(Scanner* scanner, const char* message) {
-    Token token = {
-        .type = TOKEN_ERROR,
-        .start = message,
-        .length = (int) strlen(message),
-        .line = scanner->line
-    };
-
-    return token;
+static TokenType error(Scanner* scanner, ScanError error) {
+    scanner->error = error;
+    return TOKEN_ERROR;
 }
 
 static bool match(Scanner* scanner, char expected) {
@@ -115,30 +314,13 @@ static bool match(Scanner* scanner, char expected) {
 
 static void skip_whitespace(Scanner* scanner) {
     while(true) {
-        char c = peek(scanner);
-
-        switch (c) {
-            case ' ':
-            case '\r':
-            case '\t':
-                advance(scanner);
-                break;
-
-            case '\n':
-                scanner->line += 1;
-                advance(scanner);
-                break;
-
-            case '/':
-                if (peek_next(scanner) == '/') {
-                    while (peek(scanner) != '\n' && !is_at_end(scanner)) advance(scanner);
-                } else {
-                    return;
-                }
-                break;
+        scanner->current = scanner->kernels->skip_blanks(scanner->current, &scanner->line);
 
-            default:
-                return;
+        if (peek(scanner) == '/' && peek_next(scanner) == '/') {
+            // A comment goes until the end of the line.
+            scanner->current = scanner->kernels->skip_to_line_end(scanner->current);
+        } else {
+            return;
         }
     }
 }
@@ -153,46 +335,62 @@ static char peek_next(Scanner* scanner) {
 }
 
 static bool is_digit(char c) {
-    return c >= '0' && c <= '9';
+    return char_classes[(unsigned char)c] == CHAR_DIGIT;
 }
 
-static bool is_alpha(char c) {
-    return (c >= 'a' && c <= 'z') ||
-           (c >= 'A' && c <= 'Z') ||
-           c == '_';
-}
-
-static Token string(Scanner* scanner) {
-    while (peek(scanner) != '"' && !is_at_end(scanner)) {
-        if (peek(scanner) == '\n') scanner->line += 1;
-        advance(scanner);
-    }
+static TokenType string(Scanner* scanner) {
+    scanner->current = scanner->kernels->find_quote(scanner->current, &scanner->line);
 
-    if (is_at_end(scanner)) return error_token(scanner, "Unterminated string.");
+    if (is_at_end(scanner)) return error(scanner, ERROR_UNTERMINATED_STRING);
 
     // The closing quote
     advance(scanner);
-    return make_token(scanner, TOKEN_STRING);
+    return TOKEN_STRING;
 }
 
-static Token identifier(Scanner* scanner) {
-    while (is_alpha(peek(scanner)) || is_digit(peek(scanner))) advance(scanner);
+static TokenType identifier(Scanner* scanner) {
+    scanner->current = scanner->kernels->skip_identifier(scanner->current);
 
-    return make_token(scanner, identifier_type(scanner));
+    return identifier_type(scanner);
 }
 
-static Token number(Scanner* scanner) {
-    while (is_digit(peek(scanner))) advance(scanner);
+static TokenType number(Scanner* scanner) {
+    // next_token already consumed the first digit.
+    DecimalNumber number = { (uint64_t)(scanner->start[0] - '0'), 0, 0, false };
+    number.digits = number.mantissa != 0;
+
+    scan_digits(scanner, &number, false);
 
     // Look for a fractional part.
-    if (peek(scanner) != '.' && is_digit(peek_next(scanner))) {
+    if (peek(scanner) == '.' && is_digit(peek_next(scanner))) {
         // Consume the ".".
         advance(scanner);
 
-        while(is_digit(peek(scanner))) advance(scanner);
+        scan_digits(scanner, &number, true);
+    }
+
+    if (number.truncated ||
+        !decimal_to_double(number.mantissa, number.exponent, &scanner->number)) {
+        scanner->number = parse_number(scanner->start, (int)(scanner->current - scanner->start));
     }
 
-    return make_token(scanner, TOKEN_NUMBER);
+    return TOKEN_NUMBER;
+}
+
+// Consumes a run of digits, folding them into the mantissa while it has
+// room. Past that the rest are skipped in bulk, for parse_number() to read.
+static void scan_digits(Scanner* scanner, DecimalNumber* number, bool fraction) {
+    while (is_digit(peek(scanner))) {
+        if (number->digits == MANTISSA_DIGITS_MAX) {
+            number->truncated = true;
+            scanner->current = scanner->kernels->skip_digits(scanner->current);
+            return;
+        }
+
+        number->mantissa = number->mantissa * 10 + (uint64_t)(advance(scanner) - '0');
+        if (number->mantissa != 0) number->digits += 1;
+        if (fraction) number->exponent -= 1;
+    }
 }
 
 static TokenType check_keyword(Scanner* scanner, int start, int length, const char* rest, TokenType type) {
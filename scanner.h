@@ -5,10 +5,16 @@
 #ifndef LOX_SCANNER_H
 #define LOX_SCANNER_H
 
+#include "memory.h"
+#include "scanner_simd.h"
+
 typedef struct {
     const char* start;
     const char* current;
     int line;
+    int error; // Which message a TOKEN_ERROR carries.
+    double number; // Value of a TOKEN_NUMBER, computed while scanning it.
+    const ScanKernels* kernels;
 } Scanner;
 
 typedef enum {
@@ -42,9 +48,30 @@ typedef struct {
     const char* start;
     int length;
     int line;
+    double number; // Only for TOKEN_NUMBER.
 } Token;
 
+// A whole source scanned up front, one array per token field. Offsets are
+// into source, except for TOKEN_ERROR where they select the message.
+typedef struct {
+    int capacity;
+    int count;
+    uint8_t* types;
+    int* offsets;
+    int* lengths;
+    int* lines;
+    double* numbers; // Only set for TOKEN_NUMBER.
+    const char* source;
+    Arena* arena;
+} TokenBuffer;
+
 void init_scanner(Scanner*, const char* source);
+void init_scanner_with_kernels(Scanner*, const char* source, const ScanKernels*);
 Token scan_token(Scanner*);
 
+void init_token_buffer(TokenBuffer*, Arena*);
+void free_token_buffer(TokenBuffer*);
+void tokenize(TokenBuffer*, const char* source);
+Token token_at(TokenBuffer*, int index);
+
 #endif //LOX_SCANNER_H
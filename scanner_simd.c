@@ -0,0 +1,385 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include "scanner_simd.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+// Scalar
+
+static bool is_identifier_char(char c) {
+    return (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') ||
+           c == '_';
+}
+
+static const char* scalar_skip_blanks(const char* current, int* lines) {
+    while (true) {
+        switch (*current) {
+            case ' ':
+            case '\r':
+            case '\t':
+                break;
+            case '\n':
+                *lines += 1;
+                break;
+            default:
+                return current;
+        }
+        current += 1;
+    }
+}
+
+static const char* scalar_skip_to_line_end(const char* current) {
+    while (*current != '\n' && *current != '\0') current += 1;
+    return current;
+}
+
+static const char* scalar_find_quote(const char* current, int* lines) {
+    while (*current != '"' && *current != '\0') {
+        if (*current == '\n') *lines += 1;
+        current += 1;
+    }
+    return current;
+}
+
+static const char* scalar_skip_identifier(const char* current) {
+    while (is_identifier_char(*current)) current += 1;
+    return current;
+}
+
+static const char* scalar_skip_digits(const char* current) {
+    while (*current >= '0' && *current <= '9') current += 1;
+    return current;
+}
+
+static const ScanKernels scalar_kernels = {
+    "scalar",
+    scalar_skip_blanks,
+    scalar_skip_to_line_end,
+    scalar_find_quote,
+    scalar_skip_identifier,
+    scalar_skip_digits,
+};
+
+#ifdef SCAN_X86
+
+// Every vector kernel works the same way: load the aligned block holding
+// current, build a bit mask of the bytes that end the run, ignore the bits
+// before current, and keep loading blocks until a bit is set. Newlines are
+// counted with a popcount over the bytes that were skipped.
+
+// The bytes a block holds past the terminator (or before the source) are
+// loaded but never looked at: every mask is cut off at the first stop. An
+// aligned load cannot fault where the terminator's own byte does not, but
+// AddressSanitizer sees it as an overflow of the source's allocation, so
+// the two loads are left uninstrumented rather than making every caller pad
+// its source to a whole block.
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+
+// Bytes handled one at a time before switching to whole blocks.
+#define SCALAR_PREFIX_LENGTH 8
+
+#define SCALAR_PREFIX(continues, on_byte)                           \
+    for (int prefix = 0; prefix < SCALAR_PREFIX_LENGTH; prefix += 1) { \
+        if (!(continues)) return current;                           \
+        on_byte;                                                    \
+        current += 1;                                               \
+    }
+
+static inline bool is_blank_char(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// SSE2
+
+#define SSE2_WIDTH 16
+#define SSE2_ALL ((uint32_t)0xffff)
+
+static inline NO_SANITIZE_ADDRESS __m128i sse2_load(const char* block) {
+    return _mm_load_si128((const __m128i*)block);
+}
+
+static inline uint32_t sse2_equal(__m128i chunk, char c) {
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)));
+}
+
+static inline uint32_t sse2_in_range(__m128i chunk, char low, char high) {
+    __m128i above = _mm_cmpgt_epi8(chunk, _mm_set1_epi8((char)(low - 1)));
+    __m128i below = _mm_cmplt_epi8(chunk, _mm_set1_epi8((char)(high + 1)));
+    return (uint32_t)_mm_movemask_epi8(_mm_and_si128(above, below));
+}
+
+static inline uint32_t sse2_identifier_mask(__m128i chunk) {
+    // Setting bit 5 folds upper case onto lower case without letting any
+    // other byte into the a-z range.
+    __m128i folded = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+    return sse2_in_range(folded, 'a', 'z') | sse2_in_range(chunk, '0', '9') | sse2_equal(chunk, '_');
+}
+
+static inline uint32_t sse2_blank_mask(__m128i chunk) {
+    return sse2_equal(chunk, ' ') | sse2_equal(chunk, '\t') |
+           sse2_equal(chunk, '\r') | sse2_equal(chunk, '\n');
+}
+
+static inline uint32_t leading_mask(uint32_t all, size_t misalign) {
+    return (all << misalign) & all;
+}
+
+static inline uint32_t bits_below(int position) {
+    return ((uint32_t)1 << position) - 1;
+}
+
+static const char* sse2_skip_blanks(const char* current, int* lines) {
+    // Most runs are shorter than a vector; finish those without going wide.
+    SCALAR_PREFIX(is_blank_char(*current), if (*current == '\n') *lines += 1);
+    size_t misalign = (uintptr_t)current & (SSE2_WIDTH - 1);
+    const char* block = current - misalign;
+    uint32_t valid = leading_mask(SSE2_ALL, misalign);
+
+    while (true) {
+        __m128i chunk = sse2_load(block);
+        uint32_t newlines = sse2_equal(chunk, '\n') & valid;
+        uint32_t stop = ~sse2_blank_mask(chunk) & valid;
+
+        if (stop) {
+            int end = __builtin_ctz(stop);
+            *lines += __builtin_popcount(newlines & bits_below(end));
+            return block + end;
+        }
+
+        *lines += __builtin_popcount(newlines);
+        block += SSE2_WIDTH;
+        valid = SSE2_ALL;
+    }
+}
+
+static const char* sse2_skip_to_line_end(const char* current) {
+    size_t misalign = (uintptr_t)current & (SSE2_WIDTH - 1);
+    const char* block = current - misalign;
+    uint32_t valid = leading_mask(SSE2_ALL, misalign);
+
+    while (true) {
+        __m128i chunk = sse2_load(block);
+        uint32_t stop = (sse2_equal(chunk, '\n') | sse2_equal(chunk, '\0')) & valid;
+        if (stop) return block + __builtin_ctz(stop);
+
+        block += SSE2_WIDTH;
+        valid = SSE2_ALL;
+    }
+}
+
+static const char* sse2_find_quote(const char* current, int* lines) {
+    size_t misalign = (uintptr_t)current & (SSE2_WIDTH - 1);
+    const char* block = current - misalign;
+    uint32_t valid = leading_mask(SSE2_ALL, misalign);
+
+    while (true) {
+        __m128i chunk = sse2_load(block);
+        uint32_t newlines = sse2_equal(chunk, '\n') & valid;
+        uint32_t stop = (sse2_equal(chunk, '"') | sse2_equal(chunk, '\0')) & valid;
+
+        if (stop) {
+            int end = __builtin_ctz(stop);
+            *lines += __builtin_popcount(newlines & bits_below(end));
+            return block + end;
+        }
+
+        *lines += __builtin_popcount(newlines);
+        block += SSE2_WIDTH;
+        valid = SSE2_ALL;
+    }
+}
+
+static const char* sse2_skip_identifier(const char* current) {
+    SCALAR_PREFIX(is_identifier_char(*current), );
+    size_t misalign = (uintptr_t)current & (SSE2_WIDTH - 1);
+    const char* block = current - misalign;
+    uint32_t stop = ~sse2_identifier_mask(sse2_load(block)) & leading_mask(SSE2_ALL, misalign);
+
+    while (!stop) {
+        block += SSE2_WIDTH;
+        stop = ~sse2_identifier_mask(sse2_load(block)) & SSE2_ALL;
+    }
+
+    return block + __builtin_ctz(stop);
+}
+
+static const char* sse2_skip_digits(const char* current) {
+    SCALAR_PREFIX(*current >= '0' && *current <= '9', );
+    size_t misalign = (uintptr_t)current & (SSE2_WIDTH - 1);
+    const char* block = current - misalign;
+    uint32_t stop = ~sse2_in_range(sse2_load(block), '0', '9') & leading_mask(SSE2_ALL, misalign);
+
+    while (!stop) {
+        block += SSE2_WIDTH;
+        stop = ~sse2_in_range(sse2_load(block), '0', '9') & SSE2_ALL;
+    }
+
+    return block + __builtin_ctz(stop);
+}
+
+static const ScanKernels sse2_kernels = {
+    "sse2",
+    sse2_skip_blanks,
+    sse2_skip_to_line_end,
+    sse2_find_quote,
+    sse2_skip_identifier,
+    sse2_skip_digits,
+};
+
+// AVX2
+
+#define AVX2 __attribute__((target("avx2")))
+#define AVX2_WIDTH 32
+#define AVX2_ALL ((uint32_t)0xffffffff)
+
+static inline AVX2 NO_SANITIZE_ADDRESS __m256i avx2_load(const char* block) {
+    return _mm256_load_si256((const __m256i*)block);
+}
+
+static inline AVX2 uint32_t avx2_equal(__m256i chunk, char c) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c)));
+}
+
+static inline AVX2 uint32_t avx2_in_range(__m256i chunk, char low, char high) {
+    __m256i above = _mm256_cmpgt_epi8(chunk, _mm256_set1_epi8((char)(low - 1)));
+    __m256i below = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(high + 1)), chunk);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(above, below));
+}
+
+static inline AVX2 uint32_t avx2_identifier_mask(__m256i chunk) {
+    __m256i folded = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+    return avx2_in_range(folded, 'a', 'z') | avx2_in_range(chunk, '0', '9') | avx2_equal(chunk, '_');
+}
+
+static inline AVX2 uint32_t avx2_blank_mask(__m256i chunk) {
+    return avx2_equal(chunk, ' ') | avx2_equal(chunk, '\t') |
+           avx2_equal(chunk, '\r') | avx2_equal(chunk, '\n');
+}
+
+static AVX2 const char* avx2_skip_blanks(const char* current, int* lines) {
+    SCALAR_PREFIX(is_blank_char(*current), if (*current == '\n') *lines += 1);
+    size_t misalign = (uintptr_t)current & (AVX2_WIDTH - 1);
+    const char* block = current - misalign;
+    uint32_t valid = leading_mask(AVX2_ALL, misalign);
+
+    while (true) {
+        __m256i chunk = avx2_load(block);
+        uint32_t newlines = avx2_equal(chunk, '\n') & valid;
+        uint32_t stop = ~avx2_blank_mask(chunk) & valid;
+
+        if (stop) {
+            int end = __builtin_ctz(stop);
+            *lines += __builtin_popcount(newlines & bits_below(end));
+            return block + end;
+        }
+
+        *lines += __builtin_popcount(newlines);
+        block += AVX2_WIDTH;
+        valid = AVX2_ALL;
+    }
+}
+
+static AVX2 const char* avx2_skip_to_line_end(const char* current) {
+    size_t misalign = (uintptr_t)current & (AVX2_WIDTH - 1);
+    const char* block = current - misalign;
+    uint32_t valid = leading_mask(AVX2_ALL, misalign);
+
+    while (true) {
+        __m256i chunk = avx2_load(block);
+        uint32_t stop = (avx2_equal(chunk, '\n') | avx2_equal(chunk, '\0')) & valid;
+        if (stop) return block + __builtin_ctz(stop);
+
+        block += AVX2_WIDTH;
+        valid = AVX2_ALL;
+    }
+}
+
+static AVX2 const char* avx2_find_quote(const char* current, int* lines) {
+    size_t misalign = (uintptr_t)current & (AVX2_WIDTH - 1);
+    const char* block = current - misalign;
+    uint32_t valid = leading_mask(AVX2_ALL, misalign);
+
+    while (true) {
+        __m256i chunk = avx2_load(block);
+        uint32_t newlines = avx2_equal(chunk, '\n') & valid;
+        uint32_t stop = (avx2_equal(chunk, '"') | avx2_equal(chunk, '\0')) & valid;
+
+        if (stop) {
+            int end = __builtin_ctz(stop);
+            *lines += __builtin_popcount(newlines & bits_below(end));
+            return block + end;
+        }
+
+        *lines += __builtin_popcount(newlines);
+        block += AVX2_WIDTH;
+        valid = AVX2_ALL;
+    }
+}
+
+static AVX2 const char* avx2_skip_identifier(const char* current) {
+    SCALAR_PREFIX(is_identifier_char(*current), );
+    size_t misalign = (uintptr_t)current & (AVX2_WIDTH - 1);
+    const char* block = current - misalign;
+    uint32_t stop = ~avx2_identifier_mask(avx2_load(block)) & leading_mask(AVX2_ALL, misalign);
+
+    while (!stop) {
+        block += AVX2_WIDTH;
+        stop = ~avx2_identifier_mask(avx2_load(block));
+    }
+
+    return block + __builtin_ctz(stop);
+}
+
+static AVX2 const char* avx2_skip_digits(const char* current) {
+    SCALAR_PREFIX(*current >= '0' && *current <= '9', );
+    size_t misalign = (uintptr_t)current & (AVX2_WIDTH - 1);
+    const char* block = current - misalign;
+    uint32_t stop = ~avx2_in_range(avx2_load(block), '0', '9') & leading_mask(AVX2_ALL, misalign);
+
+    while (!stop) {
+        block += AVX2_WIDTH;
+        stop = ~avx2_in_range(avx2_load(block), '0', '9');
+    }
+
+    return block + __builtin_ctz(stop);
+}
+
+static const ScanKernels avx2_kernels = {
+    "avx2",
+    avx2_skip_blanks,
+    avx2_skip_to_line_end,
+    avx2_find_quote,
+    avx2_skip_identifier,
+    avx2_skip_digits,
+};
+
+#endif
+
+// Public
+
+const ScanKernels* scan_kernels(ScanKernel kernel) {
+    switch (kernel) {
+        case SCAN_KERNEL_SCALAR:
+            return &scalar_kernels;
+#ifdef SCAN_X86
+        case SCAN_KERNEL_SSE2:
+            return &sse2_kernels;
+        case SCAN_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2") ? &avx2_kernels : NULL;
+        case SCAN_KERNEL_AUTO:
+            return __builtin_cpu_supports("avx2") ? &avx2_kernels : &sse2_kernels;
+#else
+        case SCAN_KERNEL_AUTO:
+            return &scalar_kernels;
+#endif
+        default:
+            return NULL;
+    }
+}
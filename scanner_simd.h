@@ -0,0 +1,38 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_SCANNER_SIMD_H
+#define LOX_SCANNER_SIMD_H
+
+#include "common.h"
+
+typedef enum {
+    SCAN_KERNEL_AUTO,
+    SCAN_KERNEL_SCALAR,
+    SCAN_KERNEL_SSE2,
+    SCAN_KERNEL_AVX2,
+} ScanKernel;
+
+// Run skippers used by the scanner. Each one takes a pointer into
+// NUL-terminated source and returns the first byte that ends the run; the
+// terminator always ends a run. Kernels that count newlines add them to
+// *lines.
+//
+// The vector kernels only ever load whole aligned blocks, so they may read
+// bytes around the run, including past the terminator, but never cross into
+// a page the source does not touch. Those loads are deliberate and exempt
+// from AddressSanitizer; sources need no padding.
+typedef struct ScanKernels {
+    const char* name;
+    const char* (*skip_blanks)(const char* current, int* lines);
+    const char* (*skip_to_line_end)(const char* current);
+    const char* (*find_quote)(const char* current, int* lines);
+    const char* (*skip_identifier)(const char* current);
+    const char* (*skip_digits)(const char* current);
+} ScanKernels;
+
+// Returns NULL when the requested kernel is not supported by this CPU.
+const ScanKernels* scan_kernels(ScanKernel);
+
+#endif //LOX_SCANNER_SIMD_H
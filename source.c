@@ -0,0 +1,116 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "source.h"
+
+// Forward declarations
+
+static bool map_source(Source*, int fd, size_t length);
+static bool read_source(Source*, int fd);
+
+// Public
+
+bool open_source(Source* source, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    bool ok;
+    source->regular_file = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+    if (source->regular_file) {
+        ok = map_source(source, fd, (size_t)info.st_size) || read_source(source, fd);
+    } else {
+        ok = read_source(source, fd);
+    }
+
+    close(fd);
+    return ok;
+}
+
+void close_source(Source* source) {
+    if (source->mapped_size > 0) {
+        munmap((void*)source->text, source->mapped_size);
+    } else {
+        free((void*)source->text);
+    }
+
+    source->text = NULL;
+    source->length = 0;
+    source->mapped_size = 0;
+    source->regular_file = false;
+}
+
+// Private
+
+// The text is mapped over a zeroed anonymous region a whole page longer than
+// the file's pages, so nothing that runs past the text leaves the mapping.
+// The terminator comes for free: the kernel zero-fills the tail of the last
+// file page, or it is the first byte of the zeroed page. A file that grew
+// since it was measured has text there instead, and is read after all.
+static bool map_source(Source* source, int fd, size_t length) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t file_pages = (length + page_size - 1) / page_size;
+    size_t mapped_size = (file_pages + 1) * page_size;
+
+    char* base = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return false;
+
+    if (length > 0 &&
+        mmap(base, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, mapped_size);
+        return false;
+    }
+
+    if (base[length] != '\0') {
+        munmap(base, mapped_size);
+        return false;
+    }
+
+    source->text = base;
+    source->length = length;
+    source->mapped_size = mapped_size;
+    return true;
+}
+
+static bool read_source(Source* source, int fd) {
+    size_t capacity = 4096;
+    size_t length = 0;
+    char* buffer = malloc(capacity);
+    if (!buffer) return false;
+
+    while (true) {
+        if (length + 1 == capacity) {
+            char* grown = realloc(buffer, capacity * 2);
+            if (!grown) {
+                free(buffer);
+                return false;
+            }
+
+            buffer = grown;
+            capacity *= 2;
+        }
+
+        ssize_t bytes_read = read(fd, buffer + length, capacity - length - 1);
+        if (bytes_read < 0) {
+            free(buffer);
+            return false;
+        }
+        if (bytes_read == 0) break;
+
+        length += (size_t)bytes_read;
+    }
+
+    buffer[length] = '\0';
+
+    source->text = buffer;
+    source->length = length;
+    source->mapped_size = 0;
+    return true;
+}
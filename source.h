@@ -0,0 +1,24 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_SOURCE_H
+#define LOX_SOURCE_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+// A script's text, NUL-terminated as the scanner expects. Regular files are
+// mapped straight from the page cache; anything else is read into the heap.
+typedef struct {
+    const char* text;
+    size_t length;
+    size_t mapped_size; // Zero when text lives on the heap.
+    bool regular_file;  // False for pipes, terminals and other devices.
+} Source;
+
+bool open_source(Source*, const char* path);
+void close_source(Source*);
+
+#endif //LOX_SOURCE_H
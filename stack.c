@@ -0,0 +1,137 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "stack.h"
+
+// Bytes committed up front and added each time the stack grows.
+#define STACK_COMMIT_STEP (64 * 1024)
+
+// Written once, under handler_once, before any stack exists; only read
+// after that, from any thread and from the handler.
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+static struct sigaction previous_action;
+static size_t system_page_size;
+
+// Each thread runs at most one VM at a time, so the handler only needs to
+// know about the stack of the current thread.
+static __thread ValueStack* current_stack;
+
+// Forward declarations
+
+static void install_handler(void);
+static void handle_fault(int signal, siginfo_t*, void* context);
+
+static size_t page_size(void);
+static size_t reserved_size(void);
+
+// Public
+
+bool init_value_stack(ValueStack* stack) {
+    pthread_once(&handler_once, install_handler);
+
+    size_t size = reserved_size();
+    void* region = mmap(NULL, size + page_size(), PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) return false;
+
+    size_t committed = STACK_COMMIT_STEP < size ? STACK_COMMIT_STEP : size;
+    if (mprotect(region, committed, PROT_READ | PROT_WRITE) != 0) {
+        munmap(region, size + page_size());
+        return false;
+    }
+
+    stack->values = region;
+    stack->committed = committed;
+    return true;
+}
+
+void free_value_stack(ValueStack* stack) {
+    if (current_stack == stack) current_stack = NULL;
+
+    munmap(stack->values, reserved_size() + page_size());
+    stack->values = NULL;
+    stack->committed = 0;
+}
+
+void enter_value_stack(ValueStack* stack) {
+    current_stack = stack;
+}
+
+// Private
+
+static void install_handler(void) {
+    // sysconf() is not async-signal-safe, so the handler reads this instead.
+    system_page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = handle_fault;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGSEGV, &action, &previous_action);
+}
+
+// POSIX does not list mprotect() as async-signal-safe. This relies on it
+// being a plain system call, as it is on Linux and the BSDs, which takes no
+// user-space locks and touches no state the interrupted code could be
+// holding. siglongjmp() out of the handler is allowed because the only code
+// it leaves is the VM loop, which holds no locks either.
+static void handle_fault(int signal, siginfo_t* info, void* context) {
+    ValueStack* stack = current_stack;
+    char* address = info->si_addr;
+
+    if (stack) {
+        char* start = (char*)stack->values;
+        char* limit = start + reserved_size();
+
+        if (address >= start + stack->committed && address < limit) {
+            // Commit whole steps up to and including the faulting page, then
+            // return so the push runs again.
+            size_t needed = (size_t)(address - start) + 1;
+            size_t committed = (needed + STACK_COMMIT_STEP - 1) / STACK_COMMIT_STEP * STACK_COMMIT_STEP;
+            if (committed > reserved_size()) committed = reserved_size();
+
+            if (mprotect(start + stack->committed, committed - stack->committed,
+                         PROT_READ | PROT_WRITE) == 0) {
+                stack->committed = committed;
+                return;
+            }
+        }
+
+        if (address >= start + stack->committed && address < limit + page_size()) {
+            siglongjmp(stack->overflow, 1);
+        }
+    }
+
+    // Not a fault on our stack: hand it to whoever was there before.
+    if (previous_action.sa_flags & SA_SIGINFO) {
+        previous_action.sa_sigaction(signal, info, context);
+    } else if (previous_action.sa_handler != SIG_DFL && previous_action.sa_handler != SIG_IGN) {
+        previous_action.sa_handler(signal);
+    } else {
+        // Restore the default action; returning re-runs the faulting
+        // instruction, which now terminates the process as usual.
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = SIG_DFL;
+        sigaction(SIGSEGV, &action, NULL);
+    }
+}
+
+static size_t page_size(void) {
+    return system_page_size;
+}
+
+static size_t reserved_size(void) {
+    size_t size = STACK_MAX * sizeof(Value);
+    size_t page = page_size();
+    return (size + page - 1) / page * page;
+}
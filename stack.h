@@ -0,0 +1,37 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_STACK_H
+#define LOX_STACK_H
+
+#include <setjmp.h>
+
+#include "value.h"
+
+// Values reserved for one VM stack. The reservation is rounded up to whole
+// pages, so keep this a multiple of a page's worth of values for overflow
+// to be reported exactly at STACK_MAX.
+#ifndef STACK_MAX
+#define STACK_MAX (1024 * 1024)
+#endif
+
+// The value stack lives in its own mapping: STACK_MAX values of reserved
+// address space followed by a PROT_NONE guard page. Only the first pages are
+// committed up front. A push that runs into an uncommitted page faults, and
+// the SIGSEGV handler commits more and lets the push retry; a push into the
+// guard page jumps to overflow instead. Pushes never check for room.
+typedef struct {
+    Value* values;
+    size_t committed; // Bytes from values that are readable and writable.
+    sigjmp_buf overflow;
+} ValueStack;
+
+bool init_value_stack(ValueStack*);
+void free_value_stack(ValueStack*);
+
+// Makes stack the one the fault handler serves on the calling thread. Call
+// it before setting up overflow and touching the stack.
+void enter_value_stack(ValueStack*);
+
+#endif //LOX_STACK_H
@@ -0,0 +1,166 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+// Runs a script the way an embedder would, past the JIT threshold, and
+// prints what the first run gave the way lox does: the value on stdout,
+// errors on stderr, and the same exit status. Every later run, quickened or
+// compiled to native code, has to give the same outcome, or the driver
+// fails with exit status 1.
+//
+//   --no-fold   compile with compile_unfolded() and run the chunk through
+//               interpret_chunk(), instead of lox_compile() and lox_run()
+//   --registers run on the register backend until the JIT takes over
+//
+// Usage: lox_corpus_run [--no-fold] [--registers] <path>
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../compiler.h"
+#include "../jit.h"
+#include "../program.h"
+#include "../source.h"
+#include "../vm.h"
+
+#define EXIT_COMPILE_ERROR 65
+#define EXIT_RUNTIME_ERROR 70
+#define EXIT_COULD_NOT_READ_FILE 74
+
+// Enough for the stack loop to quicken, the JIT to kick in and its code to
+// run at least once.
+#define RUNS (JIT_THRESHOLD + 2)
+
+typedef struct {
+    InterpreterResult result;
+    Value value;
+    char* errors;
+    size_t errors_length;
+} Outcome;
+
+// Forward declarations
+
+static void usage(void);
+static bool run_once(VM*, LoxProgram*, Chunk*, Outcome*);
+static bool same_outcome(const Outcome*, const Outcome*);
+
+// Main
+
+int main(int argc, const char* argv[]) {
+    bool fold = true;
+    bool registers = false;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i += 1) {
+        if (strcmp(argv[i], "--no-fold") == 0) {
+            fold = false;
+        } else if (strcmp(argv[i], "--registers") == 0) {
+            registers = true;
+        } else if (strncmp(argv[i], "--", 2) != 0 && !path) {
+            path = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if (!path) usage();
+
+    Source source;
+    if (!open_source(&source, path)) {
+        fprintf(stderr, "Could not read file '%s'.", path);
+        return EXIT_COULD_NOT_READ_FILE;
+    }
+
+    // Either a shared program, or a chunk of our own to quicken in place.
+    LoxProgram* program = NULL;
+    Chunk chunk;
+    bool compiled;
+    if (fold) {
+        program = lox_compile(source.text, stderr);
+        compiled = program != NULL;
+    } else {
+        init_chunk(&chunk, NULL);
+        compiled = compile_unfolded(source.text, &chunk, stderr);
+    }
+    close_source(&source);
+    if (!compiled) {
+        if (!fold) free_chunk(&chunk);
+        return EXIT_COMPILE_ERROR;
+    }
+
+    VM vm;
+    init_vm(&vm);
+    vm.use_registers = registers;
+
+    Outcome first;
+    bool ok = run_once(&vm, program, &chunk, &first);
+    for (int run = 1; ok && run < RUNS; run += 1) {
+        Outcome outcome;
+        ok = run_once(&vm, program, &chunk, &outcome);
+        if (ok && !same_outcome(&first, &outcome)) {
+            fprintf(stderr, "Run %d of '%s' differs from the first.\n", run + 1, path);
+            ok = false;
+        }
+        free(outcome.errors);
+    }
+
+    int status = EXIT_FAILURE;
+    if (ok) {
+        if (first.result == INTERPRET_OK) {
+            output_value(&vm.output, first.value);
+            output_char(&vm.output, '\n');
+        }
+        flush_output(&vm.output);
+        fwrite(first.errors, 1, first.errors_length, stderr);
+
+        status = first.result == INTERPRET_OK ? EXIT_SUCCESS : EXIT_RUNTIME_ERROR;
+    }
+    free(first.errors);
+
+    free_vm(&vm);
+    if (program) {
+        lox_free_program(program);
+    } else {
+        free_chunk(&chunk);
+    }
+
+    return status;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: lox_corpus_run [--no-fold] [--registers] <path>\n");
+    exit(64);
+}
+
+// Private
+
+// Runs the program when there is one, the chunk otherwise, collecting what
+// the VM reports instead of letting it reach stderr.
+static bool run_once(VM* vm, LoxProgram* program, Chunk* chunk, Outcome* outcome) {
+    outcome->errors = NULL;
+    outcome->errors_length = 0;
+
+    FILE* errors = open_memstream(&outcome->errors, &outcome->errors_length);
+    if (!errors) {
+        fprintf(stderr, "Could not capture errors.\n");
+        return false;
+    }
+
+    vm->errors = errors;
+    outcome->result = program ? lox_run(vm, program) : interpret_chunk(vm, chunk);
+    outcome->value = vm->result;
+    vm->errors = stderr;
+
+    return fclose(errors) == 0;
+}
+
+// Values compare by their bits, so that NaN matches itself and -0 does not
+// match 0.
+static bool same_outcome(const Outcome* a, const Outcome* b) {
+    if (a->result != b->result) return false;
+    if (a->result == INTERPRET_OK && !values_identical(a->value, b->value)) return false;
+
+    return a->errors_length == b->errors_length &&
+           memcmp(a->errors, b->errors, a->errors_length) == 0;
+}
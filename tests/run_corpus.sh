@@ -0,0 +1,116 @@
+#!/bin/sh
+#
+# Created by rodrigo on 18/10/26.
+#
+# Runs every script in tests/corpus through each way lox has of running
+# code, and compares stdout, stderr and the exit status with the
+# expectations written at the end of the script:
+#
+#   // expect: <a line of stdout>
+#   // expect error: <a line of stderr>
+#   // expect status: <exit status, 0 when missing>
+#
+# The folder reduces any script that runs to a single constant, so every
+# mode but the cache is tried both folded and with --no-fold, which leaves
+# the arithmetic to the backend.
+#
+# Emitted C is built with the flags the runtime was built with, so that
+# sanitizer builds link.
+#
+# Usage: run_corpus.sh <lox> <lox_corpus_run> <liblox_rt.a> <cc> <cflags> <source dir>
+#
+
+if [ $# -ne 6 ]; then
+    echo "Usage: run_corpus.sh <lox> <lox_corpus_run> <liblox_rt.a> <cc> <cflags> <source dir>" >&2
+    exit 64
+fi
+
+lox=$1
+corpus_run=$2
+lox_rt=$3
+cc=$4
+cflags=$5
+source_dir=$6
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+failures=0
+cases=0
+
+# check <name> <mode> <command...>
+#
+# Runs the command and compares what it did with $work/expected.*. Shell
+# variables are global, so these names must not clash with the loop's.
+check() {
+    check_name=$1
+    check_mode=$2
+    shift 2
+
+    "$@" > "$work/stdout" 2> "$work/stderr"
+    echo $? > "$work/status"
+
+    for stream in stdout stderr status; do
+        if ! cmp -s "$work/expected.$stream" "$work/$stream"; then
+            echo "FAIL $check_name ($check_mode): $stream differs" >&2
+            diff "$work/expected.$stream" "$work/$stream" | sed 's/^/    /' >&2
+            failures=$((failures + 1))
+            return
+        fi
+    done
+}
+
+# run_emitted <script> [--no-fold]
+#
+# Compiles the script to C, and that to a program, then runs the program.
+# Scripts that do not compile stop at lox, as the program would never exist.
+run_emitted() {
+    "$lox" "$@" --emit-c > "$work/script.c" || return $?
+    # Split on purpose: the flags are one argument of space-separated words.
+    # Warnings about the emitted code are not the script's output.
+    if ! "$cc" $cflags -ffp-contract=off -I"$source_dir" -o "$work/script" "$work/script.c" \
+            "$lox_rt" -lm 2> "$work/cc.log"; then
+        cat "$work/cc.log" >&2
+        return 1
+    fi
+    "$work/script"
+}
+
+for source in "$source_dir"/tests/corpus/*.lox; do
+    name=$(basename "$source")
+    cases=$((cases + 1))
+
+    # lox writes its cache next to the script, which stays out of the tree.
+    script="$work/$name"
+    cp "$source" "$script"
+    rm -f "${script}c"
+
+    sed -n 's|^// expect: ||p' "$script" > "$work/expected.stdout"
+    sed -n 's|^// expect error: ||p' "$script" > "$work/expected.stderr"
+    status=$(sed -n 's|^// expect status: ||p' "$script")
+    echo "${status:-0}" > "$work/expected.status"
+
+    check "$name" "stack" "$lox" "$script"
+    check "$name" "cached" "$lox" "$script"
+    check "$name" "registers" "$lox" --registers "$script"
+    check "$name" "stack, unfolded" "$lox" --no-fold "$script"
+    check "$name" "registers, unfolded" "$lox" --no-fold --registers "$script"
+    check "$name" "program" "$corpus_run" "$script"
+    check "$name" "program, registers" "$corpus_run" --registers "$script"
+    check "$name" "chunk, unfolded" "$corpus_run" --no-fold "$script"
+    check "$name" "chunk, registers, unfolded" "$corpus_run" --no-fold --registers "$script"
+    check "$name" "emit-c" run_emitted "$script"
+    check "$name" "emit-c, unfolded" run_emitted --no-fold "$script"
+done
+
+if [ "$cases" -eq 0 ]; then
+    echo "No scripts in $source_dir/tests/corpus." >&2
+    exit 1
+fi
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures of $((cases * 11)) runs failed." >&2
+    exit 1
+fi
+
+echo "All $((cases * 11)) runs of $cases scripts passed."
@@ -0,0 +1,209 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+#include "debug.h"
+
+// Layout, every integer little-endian:
+//
+//   "LOXT"  u32 version  u64 source hash  u8 folded
+//   u64 records written  u32 records stored
+//   records, oldest first, as
+//     (u32 offset, u32 depth, u8 opcode, u8 top tag, u64 top bits)
+
+#define LOXT_MAGIC "LOXT"
+#define LOXT_VERSION 2
+
+typedef enum {
+    TOP_NIL,
+    TOP_FALSE,
+    TOP_TRUE,
+    TOP_NUMBER,
+} TopTag;
+
+// Forward declarations
+
+static void write_u32(FILE*, uint32_t);
+static void write_u64(FILE*, uint64_t);
+static bool read_u32(FILE*, uint32_t*);
+static bool read_u64(FILE*, uint64_t*);
+
+static void write_value(FILE*, Value);
+static bool read_value(FILE*, Value*);
+
+// Public
+
+bool init_trace_buffer(TraceBuffer* trace, size_t capacity) {
+    size_t rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+
+    trace->records = malloc(sizeof(TraceRecord) * rounded);
+    trace->capacity = rounded;
+    trace->count = 0;
+    return trace->records != NULL;
+}
+
+void free_trace_buffer(TraceBuffer* trace) {
+    free(trace->records);
+    trace->records = NULL;
+    trace->capacity = 0;
+    trace->count = 0;
+}
+
+bool save_trace(const char* path, TraceBuffer* trace, uint64_t source_hash, bool folded) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+
+    uint64_t stored = trace->count < trace->capacity ? trace->count : trace->capacity;
+
+    fwrite(LOXT_MAGIC, 1, 4, file);
+    write_u32(file, LOXT_VERSION);
+    write_u64(file, source_hash);
+    fputc(folded, file);
+    write_u64(file, trace->count);
+    write_u32(file, (uint32_t)stored);
+
+    for (uint64_t i = trace->count - stored; i < trace->count; i += 1) {
+        TraceRecord* record = &trace->records[i & (trace->capacity - 1)];
+        write_u32(file, record->offset);
+        write_u32(file, record->depth);
+        fputc(record->opcode, file);
+        write_value(file, record->top);
+    }
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+bool decode_trace(const char* path, Chunk* chunk, uint64_t source_hash, bool folded) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Could not read trace '%s'.\n", path);
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version, stored;
+    uint64_t hash, written;
+    int recorded_folded;
+    bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, LOXT_MAGIC, 4) == 0 &&
+              read_u32(file, &version) && version == LOXT_VERSION &&
+              read_u64(file, &hash) && (recorded_folded = fgetc(file)) != EOF &&
+              read_u64(file, &written) && read_u32(file, &stored);
+
+    if (!ok) {
+        fprintf(stderr, "'%s' is not a trace file.\n", path);
+        fclose(file);
+        return false;
+    }
+
+    if (hash != source_hash) {
+        fprintf(stderr, "Trace '%s' was recorded from a different source.\n", path);
+        fclose(file);
+        return false;
+    }
+
+    if (recorded_folded != folded) {
+        fprintf(stderr, "Trace '%s' was recorded %s --no-fold.\n", path,
+                folded ? "with" : "without");
+        fclose(file);
+        return false;
+    }
+
+    printf("== trace: %llu instructions, last %u kept ==\n",
+           (unsigned long long)written, stored);
+
+    for (uint32_t i = 0; i < stored; i += 1) {
+        uint32_t offset, depth;
+        int opcode;
+        Value top;
+
+        if (!read_u32(file, &offset) || !read_u32(file, &depth) ||
+            (opcode = fgetc(file)) == EOF || !read_value(file, &top) ||
+            offset >= (uint32_t)chunk->count ||
+            generic_opcode(chunk->code[offset]) != generic_opcode((uint8_t)opcode)) {
+            fprintf(stderr, "Trace '%s' is corrupt at record %u.\n", path, i);
+            fclose(file);
+            return false;
+        }
+
+        // Same shape as the old printf trace: the stack, then the instruction.
+        // The rebuilt chunk is generic, so quickened forms are named here.
+        printf("          [depth %u] ", depth);
+        if (depth > 0) print_value(top);
+        if (chunk->code[offset] != opcode) printf("  (as %s)", opcode_name((uint8_t)opcode));
+        printf("\n");
+        dissasemble_instruction(chunk, (int)offset);
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Private
+
+static void write_u32(FILE* file, uint32_t value) {
+    for (int i = 0; i < 4; i += 1) fputc((value >> (8 * i)) & 0xff, file);
+}
+
+static void write_u64(FILE* file, uint64_t value) {
+    for (int i = 0; i < 8; i += 1) fputc((value >> (8 * i)) & 0xff, file);
+}
+
+static bool read_u32(FILE* file, uint32_t* value) {
+    uint8_t bytes[4];
+    if (fread(bytes, 1, 4, file) != 4) return false;
+
+    *value = 0;
+    for (int i = 0; i < 4; i += 1) *value |= (uint32_t)bytes[i] << (8 * i);
+    return true;
+}
+
+static bool read_u64(FILE* file, uint64_t* value) {
+    uint8_t bytes[8];
+    if (fread(bytes, 1, 8, file) != 8) return false;
+
+    *value = 0;
+    for (int i = 0; i < 8; i += 1) *value |= (uint64_t)bytes[i] << (8 * i);
+    return true;
+}
+
+static void write_value(FILE* file, Value value) {
+    uint64_t bits = 0;
+
+    if (IS_NIL(value)) {
+        fputc(TOP_NIL, file);
+    } else if (IS_BOOL(value)) {
+        fputc(AS_BOOL(value) ? TOP_TRUE : TOP_FALSE, file);
+    } else {
+        double number = AS_NUMBER(value);
+        memcpy(&bits, &number, sizeof(double));
+        fputc(TOP_NUMBER, file);
+    }
+
+    write_u64(file, bits);
+}
+
+static bool read_value(FILE* file, Value* value) {
+    int tag = fgetc(file);
+    uint64_t bits;
+    if (tag == EOF || !read_u64(file, &bits)) return false;
+
+    switch (tag) {
+        case TOP_NIL:   *value = NIL_VAL; return true;
+        case TOP_FALSE: *value = BOOL_VAL(false); return true;
+        case TOP_TRUE:  *value = BOOL_VAL(true); return true;
+        case TOP_NUMBER: {
+            double number;
+            memcpy(&number, &bits, sizeof(double));
+            *value = NUMBER_VAL(number);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
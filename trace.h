@@ -0,0 +1,49 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+#ifndef LOX_TRACE_H
+#define LOX_TRACE_H
+
+#include <stddef.h>
+
+#include "chunk.h"
+
+// Number of records kept when nothing else is asked for. Only the most
+// recent ones survive; older records are overwritten.
+#define TRACE_DEFAULT_CAPACITY (64 * 1024)
+
+// One executed instruction, taken just before it runs.
+typedef struct {
+    uint32_t offset;
+    uint32_t depth;
+    uint8_t opcode;
+    Value top; // NIL_VAL when the stack is empty.
+} TraceRecord;
+
+typedef struct {
+    TraceRecord* records;
+    size_t capacity; // Always a power of two.
+    uint64_t count;  // Records written so far, including overwritten ones.
+} TraceBuffer;
+
+bool init_trace_buffer(TraceBuffer*, size_t capacity);
+void free_trace_buffer(TraceBuffer*);
+
+static inline void record_trace(TraceBuffer* trace, uint32_t offset, uint8_t opcode,
+                                uint32_t depth, Value top) {
+    TraceRecord* record = &trace->records[trace->count & (trace->capacity - 1)];
+    record->offset = offset;
+    record->depth = depth;
+    record->opcode = opcode;
+    record->top = top;
+    trace->count += 1;
+}
+
+// The file is tied to the source it was recorded from through its hash, and
+// to whether that source was folded, so the decoder can rebuild the same
+// chunk and disassemble each record against it.
+bool save_trace(const char* path, TraceBuffer*, uint64_t source_hash, bool folded);
+bool decode_trace(const char* path, Chunk*, uint64_t source_hash, bool folded);
+
+#endif //LOX_TRACE_H
@@ -7,17 +7,18 @@
 #include "value.h"
 #include "memory.h"
 
-void init_value_array(ValueArray* array) {
+void init_value_array(ValueArray* array, Arena* arena) {
     array->capacity = 0;
     array->count = 0;
     array->values = NULL;
+    array->arena = arena;
 }
 
 void write_value_array(ValueArray* array, Value value) {
     if (array->capacity < array->count + 1) {
         int old_capacity = array->capacity;
         array->capacity = GROW_CAPACITY(old_capacity);
-        array->values = GROW_ARRAY(Value, array->values, old_capacity, array->capacity);
+        array->values = GROW_ARRAY(array->arena, MEMORY_SITE_CONSTANTS, Value, array->values, old_capacity, array->capacity);
     }
 
     array->values[array->count] = value;
@@ -25,17 +26,90 @@ void write_value_array(ValueArray* array, Value value) {
 }
 
 void free_value_array(ValueArray* array) {
-    FREE_ARRAY(Value, array->values, array->capacity);
-    init_value_array(array);
+    FREE_ARRAY(array->arena, MEMORY_SITE_CONSTANTS, Value, array->values, array->capacity);
+    init_value_array(array, array->arena);
 }
 
-void print_value(Value value) {
+bool values_equal(Value a, Value b) {
+#ifdef NAN_BOXING
+    // Numbers compare as doubles so that NaN != NaN and 0 == -0.
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+
+    return a == b;
+#else
+    if (a.type != b.type) return false;
+
+    switch (a.type) {
+        case VAL_NIL: return true;
+        case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
+        case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
+        default:
+            return false; // Unreachable.
+    }
+#endif
+}
+
+// Identity is bitwise: unlike values_equal, 0 and -0 are different values
+// and a NaN is identical to itself.
+bool values_identical(Value a, Value b) {
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    if (a.type != b.type) return false;
+
+    switch (a.type) {
+        case VAL_NIL: return true;
+        case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
+        case VAL_NUMBER: return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+        default:
+            return false; // Unreachable.
+    }
+#endif
+}
+
+uint32_t hash_value(Value value) {
+    uint64_t bits;
+#ifdef NAN_BOXING
+    bits = value;
+#else
     switch (value.type) {
-        case VAL_BOOL: {
-            printf(AS_BOOL(value) ? "true" : "false");
-            break;
-        }
-        case VAL_NIL:    printf("nil"); break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value));
+        case VAL_NIL:    bits = 1; break;
+        case VAL_BOOL:   bits = AS_BOOL(value) ? 3 : 2; break;
+        case VAL_NUMBER: memcpy(&bits, &value.as.number, sizeof(double)); break;
+        default:
+            bits = 0; // Unreachable.
+    }
+#endif
+
+    // Fold the high bits down so doubles that differ only in their exponent
+    // still spread across the table.
+    bits ^= bits >> 33;
+    bits *= (uint64_t)0xff51afd7ed558ccd;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+void print_value(Value value) {
+    fprint_value(stdout, value);
+}
+
+void fprint_value(FILE* file, Value value) {
+    char text[NUMBER_BUFFER_SIZE];
+    format_value(value, text);
+    fputs(text, file);
+}
+
+int format_value(Value value, char* buffer) {
+    if (IS_BOOL(value)) {
+        bool boolean = AS_BOOL(value);
+        memcpy(buffer, boolean ? "true" : "false", boolean ? 5 : 6);
+        return boolean ? 4 : 5;
+    } else if (IS_NIL(value)) {
+        memcpy(buffer, "nil", 4);
+        return 3;
+    } else {
+        return format_number(AS_NUMBER(value), buffer);
     }
 }
\ No newline at end of file
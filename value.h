@@ -5,7 +5,51 @@
 #ifndef LOX_VALUE_H
 #define LOX_VALUE_H
 
+#include <stdio.h>
+#include <string.h>
+
 #include "common.h"
+#include "memory.h"
+#include "number.h"
+
+#ifdef NAN_BOXING
+
+// Any double whose quiet NaN bits are all set is not a number; the low bits
+// carry the tag of the singleton values.
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL   1 // 01.
+#define TAG_FALSE 2 // 10.
+#define TAG_TRUE  3 // 11.
+
+typedef uint64_t Value;
+
+#define IS_BOOL(value)   (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)    ((value) == NIL_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+
+#define AS_BOOL(value)   ((value) == TRUE_VAL)
+#define AS_NUMBER(value) value_to_num(value)
+
+#define BOOL_VAL(b)       ((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL         ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL          ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VAL           ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define NUMBER_VAL(value) num_to_value(value)
+
+static inline double value_to_num(Value value) {
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+static inline Value num_to_value(double num) {
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+#else
 
 typedef enum {
     VAL_BOOL,
@@ -32,16 +76,30 @@ typedef struct {
 #define NIL_VAL           ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 
+#endif
+
 typedef struct {
     int capacity;
     int count;
     Value* values;
+    Arena* arena;
 } ValueArray;
 
-void init_value_array(ValueArray*);
+void init_value_array(ValueArray*, Arena*);
 void write_value_array(ValueArray*, Value);
 void free_value_array(ValueArray*);
 
+static inline bool is_falsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+bool values_equal(Value, Value);
+bool values_identical(Value, Value);
+uint32_t hash_value(Value);
+// Writes the value's text, NUL-terminated, into a buffer of at least
+// NUMBER_BUFFER_SIZE bytes and returns its length.
+int format_value(Value, char* buffer);
 void print_value(Value);
+void fprint_value(FILE*, Value);
 
 #endif //LOX_VALUE_H
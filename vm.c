@@ -4,48 +4,83 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <unistd.h>
 #include "vm.h"
-#include "debug.h"
-#include "compiler.h"
+#include "jit.h"
+#include "program.h"
+#include "regvm.h"
 
 // Forward declarations
 
 static InterpreterResult run(VM*);
+static InterpreterResult execute_untraced(VM*);
+static InterpreterResult execute_traced(VM*);
+static InterpreterResult execute_profiled(VM*);
 static void reset_stack(VM*);
-static Value peek(VM*, int distance);
+static int overflow_offset(Chunk*);
 
 static void runtime_error(VM*, const char* format, ...);
 
-static bool values_equal(Value, Value);
-static bool is_falsey(Value);
 
 // Public
 
 void init_vm(VM* vm) {
+    if (!init_value_stack(&vm->stack)) {
+        fprintf(stderr, "Could not reserve the VM stack.\n");
+        exit(1);
+    }
+
+    init_arena(&vm->arena);
+    vm->trace = NULL;
+    vm->profile = NULL;
+    vm->use_registers = false;
+    vm->use_jit = true;
+    vm->result = NIL_VAL;
+    vm->errors = stderr;
+    init_output(&vm->output, STDOUT_FILENO);
+    vm->program_code = NULL;
+    vm->program_runs = 0;
     reset_stack(vm);
 }
 
 void free_vm(VM* vm) {
-
+    free_output(&vm->output);
+    free_program_code(vm);
+    free_value_stack(&vm->stack);
+    free_arena(&vm->arena);
 }
 
 InterpreterResult interpret(VM* vm, const char* source) {
-    Chunk chunk;
-    init_chunk(&chunk);
+    // Drop whatever the previous call left behind in one go.
+    reset_arena(&vm->arena);
 
-    if (!compile(source, &chunk)) {
-        free_chunk(&chunk);
+    // A program no other VM will see: it lives in the arena, and quickens in
+    // place instead of through a private copy.
+    LoxProgram program;
+    if (!init_program(&program, source, &vm->arena, vm->errors)) {
         return INTERPRET_COMPILE_ERROR;
     }
 
-    vm->chunk = &chunk;
-    vm->ip = chunk.code;
+    return interpret_chunk(vm, &program.chunk);
+}
+
+InterpreterResult interpret_chunk(VM* vm, Chunk* chunk) {
+    // Code compiled by someone else is kept, not compiled over.
+    if (vm->use_jit && !chunk->jit && chunk->runs < JIT_THRESHOLD &&
+        ++chunk->runs == JIT_THRESHOLD) {
+        chunk->jit = compile_jit(chunk);
+    }
 
-    InterpreterResult result = run(vm);
+    // Native code beats either backend, so it runs whichever one is chosen.
+    if (vm->use_registers && !chunk->jit) {
+        RegChunk* registers = translation_for(chunk);
+        if (registers) return run_registers(vm, registers);
+    }
 
-    free_chunk(&chunk);
+    vm->chunk = chunk;
+    vm->ip = chunk->code;
 
-    return result;
+    return run(vm);
 }
 
 void push(VM* vm, Value value) {
@@ -58,117 +93,122 @@ Value pop(VM* vm) {
     return *vm->stack_top;
 }
 
+const MemoryStats* get_memory_stats(VM* vm) {
+    return &vm->arena.stats;
+}
+
+void clear_memory_stats(VM* vm) {
+    // Whatever is still live in the arena stays counted as current.
+    MemoryStats* stats = &vm->arena.stats;
+    size_t current_bytes = stats->current_bytes;
+    size_t reserved_bytes = stats->reserved_bytes;
+    size_t blocks = stats->blocks;
+    size_t site_bytes[MEMORY_SITE_COUNT];
+
+    for (int i = 0; i < MEMORY_SITE_COUNT; i += 1) site_bytes[i] = stats->sites[i].current_bytes;
+
+    init_memory_stats(stats);
+
+    for (int i = 0; i < MEMORY_SITE_COUNT; i += 1) {
+        stats->sites[i].current_bytes = site_bytes[i];
+        stats->sites[i].peak_bytes = site_bytes[i];
+    }
+    stats->current_bytes = current_bytes;
+    stats->peak_bytes = current_bytes;
+    stats->reserved_bytes = reserved_bytes;
+    stats->blocks = blocks;
+}
+
 // Private
 
 static InterpreterResult run(VM* vm) {
-#define READ_BYTE() (*vm->ip++)
-#define READ_CONSTANT() (vm->chunk->constants.values[READ_BYTE()])
-#define BINARY_OP(vm, value_type, op)                             \
-    do {                                                          \
-        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
-            runtime_error(vm, "Operands must be numbers.");       \
-            return INTERPRET_RUNTIME_ERROR;                       \
-        }                                                         \
-        double b = AS_NUMBER(pop(vm));                            \
-        double a = AS_NUMBER(pop(vm));                            \
-        push(vm, value_type(a op b));                             \
-    } while(false)
-
-    while (true) {
-#ifdef DEBUG_TRACE_EXECUTION
-        printf("          ");
-        for (Value* slot = vm->stack; slot < vm->stack_top; slot += 1) {
-            printf("[ ");
-            print_value(*slot);
-            printf(" ]");
-        }
-        printf("\n");
-        dissasemble_instruction(vm->chunk, (int)(vm->ip - vm->chunk->code));
-#endif
-
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
-            case OP_CONSTANT: {
-                Value constant = READ_CONSTANT();
-                push(vm, constant);
-                break;
-            }
-            case OP_NEGATE: {
-                if (!IS_NUMBER(peek(vm, 0))) {
-                    runtime_error(vm, "Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
-                break;
-            }
+    enter_value_stack(&vm->stack);
 
-            case OP_NIL:   push(vm, NIL_VAL); break;
-            case OP_TRUE:  push(vm, BOOL_VAL(true)); break;
-            case OP_FALSE: push(vm, BOOL_VAL(false)); break;
+    // A push into the guard page lands here.
+    if (sigsetjmp(vm->stack.overflow, 0)) {
+        vm->ip = vm->chunk->code + overflow_offset(vm->chunk) + 1;
+        runtime_error(vm, "Stack overflow.");
+        return INTERPRET_RUNTIME_ERROR;
+    }
 
-            case OP_EQUAL: {
-                Value b = pop(vm);
-                Value a = pop(vm);
-                push(vm, BOOL_VAL(values_equal(a, b)));
-                break;
-            }
-
-            case OP_GREATER:  BINARY_OP(vm, BOOL_VAL, >); break;
-            case OP_LESS:     BINARY_OP(vm, BOOL_VAL, <); break;
-            case OP_ADD:      BINARY_OP(vm, NUMBER_VAL, +); break;
-            case OP_SUBTRACT: BINARY_OP(vm, NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(vm, NUMBER_VAL, *); break;
-            case OP_DIVIDE:   BINARY_OP(vm, NUMBER_VAL, /); break;
-            case OP_NOT: {
-                push(vm, BOOL_VAL(is_falsey(pop(vm))));
-                break;
-            }
-            case OP_RETURN: {
-                print_value(pop(vm));
-                printf("\n");
-                return INTERPRET_OK;
-            }
-        }
+    // Instruments both want every instruction to go through the loop. Code
+    // that exits leaves the stack as the loop expects it at the instruction
+    // it stopped at, which then runs, and reports its error, as usual.
+    if (vm->chunk->jit && vm->use_jit && !vm->profile && !vm->trace) {
+        JitExit resume;
+        if (run_jit(vm->chunk->jit, vm->stack_top, &vm->result, &resume)) return INTERPRET_OK;
+
+        vm->ip = vm->chunk->code + resume.offset;
+        vm->stack_top += resume.depth;
     }
-#undef BINARY_OP
-#undef READ_CONSTANT
-#undef READ_BYTE
+
+    if (vm->profile) return execute_profiled(vm);
+    if (vm->trace) return execute_traced(vm);
+    return execute_untraced(vm);
 }
 
+#define VM_LOOP_FUNCTION execute_untraced
+#define VM_LOOP_TRACED 0
+#define VM_LOOP_PROFILED 0
+#include "vm_loop.h"
+
+#define VM_LOOP_FUNCTION execute_traced
+#define VM_LOOP_TRACED 1
+#define VM_LOOP_PROFILED 0
+#include "vm_loop.h"
+
+#define VM_LOOP_FUNCTION execute_profiled
+#define VM_LOOP_TRACED 0
+#define VM_LOOP_PROFILED 1
+#include "vm_loop.h"
+
 static void reset_stack(VM* vm) {
-    vm->stack_top = vm->stack;
+    vm->stack_top = vm->stack.values;
 }
 
-static Value peek(VM* vm, int distance) {
-    return vm->stack_top[-1 - distance];
+// The loop keeps ip in a register, which the jump back from the fault
+// handler loses. Every run starts at the first instruction with an empty
+// stack and chunks have no jumps, so the push that overflowed is the first
+// one made at a depth of STACK_MAX.
+static int overflow_offset(Chunk* chunk) {
+    int depth = 0;
+
+    for (int offset = 0; offset < chunk->count;) {
+        OpCode instruction = generic_opcode(chunk->code[offset]);
+
+        switch (instruction) {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+                if (depth == STACK_MAX) return offset;
+                depth += 1;
+                break;
+            case OP_NOT:
+            case OP_NEGATE:
+                break;
+            default:
+                depth -= 1;
+                break;
+        }
+
+        offset += instruction == OP_CONSTANT ? 2 : instruction == OP_CONSTANT_LONG ? 4 : 1;
+    }
+
+    return 0;
 }
 
 static void runtime_error(VM* vm, const char* format, ...) {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->errors, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->errors);
 
     size_t instruction = vm->ip - vm->chunk->code - 1;
-    int line = vm->chunk->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
+    int line = get_line(vm->chunk, (int)instruction);
+    fprintf(vm->errors, "[line %d] in script\n", line);
 
     reset_stack(vm);
-}
-
-static bool is_falsey(Value value) {
-    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
-}
-
-static bool values_equal(Value a, Value b) {
-    if (a.type != b.type) return false;
-
-    switch (a.type) {
-        case VAL_NIL: return true;
-        case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
-        case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-        default:
-            return false; // Unreachable.
-    }
 }
\ No newline at end of file
@@ -5,15 +5,77 @@
 #ifndef LOX_VM_H
 #define LOX_VM_H
 
+#include <stdio.h>
+
 #include "chunk.h"
+#include "output.h"
+#include "profile.h"
+#include "stack.h"
+#include "trace.h"
+
+// A VM's own copy of the code of a shared program, see program.h.
+typedef struct {
+    uint64_t program; // Zero for an empty slot.
+    uint64_t last_run; // VM.program_runs when it last ran, zero for an empty slot.
+    uint8_t* code;
+    int count;
+
+    // The chunk fields of the same names, for this copy of the code.
+    int runs;
+    JitCode* jit;
+    RegChunk* registers;
+} ProgramCode;
 
-#define STACK_MAX 256
+// Program copies are kept in sets of PROGRAM_CODE_WAYS slots. A program's
+// id picks its set, and a program missing from its set replaces the one
+// there that ran least recently. Ids are handed out in order, so PROGRAM_CODE_SLOTS programs run side
+// by side without evicting each other, and programs whose ids share a set
+// only evict each other when more than PROGRAM_CODE_WAYS of them alternate.
+#define PROGRAM_CODE_SETS 128
+#define PROGRAM_CODE_WAYS 4
+#define PROGRAM_CODE_SLOTS (PROGRAM_CODE_SETS * PROGRAM_CODE_WAYS)
 
 typedef struct {
     Chunk* chunk;
     uint8_t* ip;
-    Value stack[STACK_MAX];
+    ValueStack stack;
     Value* stack_top;
+
+    // Holds everything one interpret() call allocates. It is reset, not
+    // freed, at the start of the next call.
+    Arena arena;
+
+    // When set, every instruction executed is recorded here. NULL by default,
+    // which selects the untraced loop.
+    TraceBuffer* trace;
+
+    // When set, every instruction is counted and timed here. Profile takes
+    // precedence over trace; it must be sized for the chunk being run.
+    Profile* profile;
+
+    // Run chunks on the register backend in regvm.c instead of the stack
+    // loop. Chunks it cannot translate still run on the stack.
+    bool use_registers;
+
+    // Compile chunks that interpret_chunk() keeps running to native code,
+    // see jit.h for which chunks those are. On by default; it has no effect
+    // in builds without a JIT.
+    bool use_jit;
+
+    // What the last successful run returned. Printing it is up to the caller.
+    Value result;
+
+    // Where results are printed, stdout by default. Callers flush it before
+    // printing to the same descriptor any other way; free_vm flushes it.
+    OutputBuffer output;
+
+    // Where compile and runtime errors are reported. stderr by default.
+    FILE* errors;
+
+    // PROGRAM_CODE_SLOTS copies for lox_run(), allocated by the first call,
+    // and the number of lox_run() calls so far, which orders them by use.
+    ProgramCode* program_code;
+    uint64_t program_runs;
 } VM;
 
 typedef enum {
@@ -26,7 +88,14 @@ void init_vm(VM*);
 void free_vm(VM*);
 
 InterpreterResult interpret(VM* vm, const char* source);
+InterpreterResult interpret_chunk(VM* vm, Chunk*);
 void push(VM*, Value);
 Value pop(VM*);
 
+// Allocation counters for everything built in the VM's arena since init_vm
+// or the last clear_memory_stats. Program copies and anything else outside
+// the arena are counted by get_heap_memory_stats().
+const MemoryStats* get_memory_stats(VM*);
+void clear_memory_stats(VM*);
+
 #endif //LOX_VM_H
@@ -0,0 +1,302 @@
+//
+// Created by rodrigo on 18/10/26.
+//
+
+// The body of the VM's dispatch loop. vm.c includes this file once per
+// variant, so there is deliberately no include guard. Define before including:
+//
+//   VM_LOOP_FUNCTION  the name of the function to define
+//   VM_LOOP_TRACED    1 to record every instruction into vm->trace, 0 not to
+//   VM_LOOP_PROFILED  1 to count and time every instruction into vm->profile
+//
+// The plain variant compiles to exactly the loop it was before tracing
+// existed; the choice between them is made once per run, not per instruction.
+
+static InterpreterResult VM_LOOP_FUNCTION(VM* vm) {
+    // The hot state lives in locals so the compiler can keep it in registers;
+    // it is only written back to the VM when something outside the loop needs it.
+    uint8_t* ip = vm->ip;
+    Value* stack_top = vm->stack_top;
+    Value* constants = vm->chunk->constants.values;
+#if VM_LOOP_TRACED || VM_LOOP_PROFILED
+    uint8_t* code = vm->chunk->code;
+#endif
+#if VM_LOOP_TRACED
+    TraceBuffer* trace = vm->trace;
+#endif
+#if VM_LOOP_PROFILED
+    // Time is charged to an instruction from its dispatch to the next one.
+    Profile* profile = vm->profile;
+    int profiled = (int)(ip - code);
+    uint64_t started = read_cycles();
+#endif
+
+#define READ_BYTE() (*ip++)
+#define READ_CONSTANT() (constants[READ_BYTE()])
+#define READ_CONSTANT_LONG() \
+    (ip += 3, constants[ip[-3] | (ip[-2] << 8) | (ip[-1] << 16)])
+#define PUSH(value) (*stack_top++ = (value))
+#define POP() (*--stack_top)
+#define PEEK(distance) (stack_top[-1 - (distance)])
+#define STORE_FRAME() (vm->ip = ip, vm->stack_top = stack_top)
+#define RUNTIME_ERROR(...)                        \
+    do {                                          \
+        STORE_FRAME();                            \
+        FINISH_PROFILE();                         \
+        runtime_error(vm, __VA_ARGS__);           \
+        return INTERPRET_RUNTIME_ERROR;           \
+    } while (false)
+// Generic instructions that see numbers rewrite themselves into their
+// quickened form; the quickened form puts the generic one back when its
+// guard fails. Either way the current instruction keeps running.
+#define QUICKEN(opcode) (ip[-1] = (opcode))
+#define DEOPTIMIZE(opcode) (ip[-1] = (opcode))
+#define BINARY_OP(value_type, op, quickened)                      \
+    do {                                                          \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {         \
+            RUNTIME_ERROR("Operands must be numbers.");           \
+        }                                                         \
+        QUICKEN(quickened);                                       \
+        double b = AS_NUMBER(POP());                              \
+        double a = AS_NUMBER(POP());                              \
+        PUSH(value_type(a op b));                                 \
+    } while(false)
+// Lox defines a >= b as !(a < b) and a <= b as !(a > b), which is not what
+// the C operators do when a NaN is involved.
+#define NEGATED_COMPARISON_OP(op, quickened)                      \
+    do {                                                          \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {         \
+            RUNTIME_ERROR("Operands must be numbers.");           \
+        }                                                         \
+        QUICKEN(quickened);                                       \
+        double b = AS_NUMBER(POP());                              \
+        double a = AS_NUMBER(POP());                              \
+        PUSH(BOOL_VAL(!(a op b)));                                \
+    } while(false)
+// Operands are read in place and the result overwrites the left one, with
+// a single branch for the guard. Number-only operators have nothing to fall
+// back to, so a failed guard deoptimizes and reports the error.
+#define NUMBER_OP(result, generic)                                \
+    do {                                                          \
+        Value b = PEEK(0);                                        \
+        Value a = PEEK(1);                                        \
+        if (!(IS_NUMBER(a) & IS_NUMBER(b))) {                     \
+            DEOPTIMIZE(generic);                                  \
+            RUNTIME_ERROR("Operands must be numbers.");           \
+        }                                                         \
+        double x = AS_NUMBER(a);                                  \
+        double y = AS_NUMBER(b);                                  \
+        stack_top -= 1;                                           \
+        stack_top[-1] = (result);                                 \
+    } while(false)
+
+#if VM_LOOP_TRACED
+#define TRACE_INSTRUCTION()                                                     \
+    do {                                                                        \
+        uint32_t depth = (uint32_t)(stack_top - vm->stack.values);              \
+        record_trace(trace, (uint32_t)(ip - code), *ip, depth,                  \
+                     depth > 0 ? stack_top[-1] : NIL_VAL);                      \
+    } while (false)
+#else
+#define TRACE_INSTRUCTION() do { } while (false)
+#endif
+
+#if VM_LOOP_PROFILED
+#define PROFILE_INSTRUCTION()                                                   \
+    do {                                                                        \
+        uint64_t now = read_cycles();                                           \
+        profile->cycles[profiled] += now - started;                             \
+        started = now;                                                          \
+        profiled = (int)(ip - code);                                            \
+        profile->counts[profiled] += 1;                                         \
+    } while (false)
+#define FINISH_PROFILE() (profile->cycles[profiled] += read_cycles() - started)
+#else
+#define PROFILE_INSTRUCTION() do { } while (false)
+#define FINISH_PROFILE() do { } while (false)
+#endif
+
+#ifdef COMPUTED_GOTO
+    // Every handler ends in its own indirect jump, which gives the branch
+    // predictor one history per opcode instead of a single shared switch.
+    static void* const dispatch_table[] = {
+        [OP_CONSTANT]          = &&do_OP_CONSTANT,
+        [OP_CONSTANT_LONG]     = &&do_OP_CONSTANT_LONG,
+        [OP_NIL]               = &&do_OP_NIL,
+        [OP_TRUE]              = &&do_OP_TRUE,
+        [OP_FALSE]             = &&do_OP_FALSE,
+        [OP_EQUAL]             = &&do_OP_EQUAL,
+        [OP_NOT_EQUAL]         = &&do_OP_NOT_EQUAL,
+        [OP_GREATER]           = &&do_OP_GREATER,
+        [OP_GREATER_EQUAL]     = &&do_OP_GREATER_EQUAL,
+        [OP_LESS]              = &&do_OP_LESS,
+        [OP_LESS_EQUAL]        = &&do_OP_LESS_EQUAL,
+        [OP_ADD]               = &&do_OP_ADD,
+        [OP_SUBTRACT]          = &&do_OP_SUBTRACT,
+        [OP_MULTIPLY]          = &&do_OP_MULTIPLY,
+        [OP_DIVIDE]            = &&do_OP_DIVIDE,
+        [OP_NOT]               = &&do_OP_NOT,
+        [OP_NEGATE]            = &&do_OP_NEGATE,
+        [OP_RETURN]            = &&do_OP_RETURN,
+        [OP_ADD_NUM]           = &&do_OP_ADD_NUM,
+        [OP_SUBTRACT_NUM]      = &&do_OP_SUBTRACT_NUM,
+        [OP_MULTIPLY_NUM]      = &&do_OP_MULTIPLY_NUM,
+        [OP_DIVIDE_NUM]        = &&do_OP_DIVIDE_NUM,
+        [OP_GREATER_NUM]       = &&do_OP_GREATER_NUM,
+        [OP_GREATER_EQUAL_NUM] = &&do_OP_GREATER_EQUAL_NUM,
+        [OP_LESS_NUM]          = &&do_OP_LESS_NUM,
+        [OP_LESS_EQUAL_NUM]    = &&do_OP_LESS_EQUAL_NUM,
+        [OP_EQUAL_NUM]         = &&do_OP_EQUAL_NUM,
+        [OP_NOT_EQUAL_NUM]     = &&do_OP_NOT_EQUAL_NUM,
+        [OP_NEGATE_NUM]        = &&do_OP_NEGATE_NUM,
+    };
+
+#define DISPATCH()                            \
+    do {                                      \
+        TRACE_INSTRUCTION();                  \
+        PROFILE_INSTRUCTION();                \
+        goto *dispatch_table[READ_BYTE()];    \
+    } while (false)
+#define CASE(opcode) do_##opcode:
+#define NEXT() DISPATCH()
+
+    DISPATCH();
+#else
+#define CASE(opcode) case opcode:
+#define NEXT() break
+
+    while (true) {
+        TRACE_INSTRUCTION();
+        PROFILE_INSTRUCTION();
+
+        switch (READ_BYTE()) {
+#endif
+            CASE(OP_CONSTANT) {
+                Value constant = READ_CONSTANT();
+                PUSH(constant);
+                NEXT();
+            }
+            CASE(OP_CONSTANT_LONG) {
+                Value constant = READ_CONSTANT_LONG();
+                PUSH(constant);
+                NEXT();
+            }
+            CASE(OP_NEGATE) {
+                if (!IS_NUMBER(PEEK(0))) {
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+                QUICKEN(OP_NEGATE_NUM);
+                stack_top[-1] = NUMBER_VAL(-AS_NUMBER(stack_top[-1]));
+                NEXT();
+            }
+
+            CASE(OP_NIL)   PUSH(NIL_VAL); NEXT();
+            CASE(OP_TRUE)  PUSH(BOOL_VAL(true)); NEXT();
+            CASE(OP_FALSE) PUSH(BOOL_VAL(false)); NEXT();
+
+            CASE(OP_EQUAL) {
+                Value b = POP();
+                Value a = POP();
+                if (IS_NUMBER(a) && IS_NUMBER(b)) QUICKEN(OP_EQUAL_NUM);
+                PUSH(BOOL_VAL(values_equal(a, b)));
+                NEXT();
+            }
+
+            CASE(OP_NOT_EQUAL) {
+                Value b = POP();
+                Value a = POP();
+                if (IS_NUMBER(a) && IS_NUMBER(b)) QUICKEN(OP_NOT_EQUAL_NUM);
+                PUSH(BOOL_VAL(!values_equal(a, b)));
+                NEXT();
+            }
+
+            CASE(OP_GREATER)       BINARY_OP(BOOL_VAL, >, OP_GREATER_NUM); NEXT();
+            CASE(OP_GREATER_EQUAL) NEGATED_COMPARISON_OP(<, OP_GREATER_EQUAL_NUM); NEXT();
+            CASE(OP_LESS)          BINARY_OP(BOOL_VAL, <, OP_LESS_NUM); NEXT();
+            CASE(OP_LESS_EQUAL)    NEGATED_COMPARISON_OP(>, OP_LESS_EQUAL_NUM); NEXT();
+            CASE(OP_ADD)      BINARY_OP(NUMBER_VAL, +, OP_ADD_NUM); NEXT();
+            CASE(OP_SUBTRACT) BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT_NUM); NEXT();
+            CASE(OP_MULTIPLY) BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM); NEXT();
+            CASE(OP_DIVIDE)   BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUM); NEXT();
+            CASE(OP_NOT) {
+                stack_top[-1] = BOOL_VAL(is_falsey(stack_top[-1]));
+                NEXT();
+            }
+            CASE(OP_ADD_NUM)           NUMBER_OP(NUMBER_VAL(x + y), OP_ADD); NEXT();
+            CASE(OP_SUBTRACT_NUM)      NUMBER_OP(NUMBER_VAL(x - y), OP_SUBTRACT); NEXT();
+            CASE(OP_MULTIPLY_NUM)      NUMBER_OP(NUMBER_VAL(x * y), OP_MULTIPLY); NEXT();
+            CASE(OP_DIVIDE_NUM)        NUMBER_OP(NUMBER_VAL(x / y), OP_DIVIDE); NEXT();
+            CASE(OP_GREATER_NUM)       NUMBER_OP(BOOL_VAL(x > y), OP_GREATER); NEXT();
+            CASE(OP_GREATER_EQUAL_NUM) NUMBER_OP(BOOL_VAL(!(x < y)), OP_GREATER_EQUAL); NEXT();
+            CASE(OP_LESS_NUM)          NUMBER_OP(BOOL_VAL(x < y), OP_LESS); NEXT();
+            CASE(OP_LESS_EQUAL_NUM)    NUMBER_OP(BOOL_VAL(!(x > y)), OP_LESS_EQUAL); NEXT();
+
+            // Equality is defined for every type, so a failed guard just
+            // hands the operands to the generic comparison.
+            CASE(OP_EQUAL_NUM) {
+                Value b = POP();
+                Value a = POP();
+                if (IS_NUMBER(a) & IS_NUMBER(b)) {
+                    PUSH(BOOL_VAL(AS_NUMBER(a) == AS_NUMBER(b)));
+                } else {
+                    DEOPTIMIZE(OP_EQUAL);
+                    PUSH(BOOL_VAL(values_equal(a, b)));
+                }
+                NEXT();
+            }
+            CASE(OP_NOT_EQUAL_NUM) {
+                Value b = POP();
+                Value a = POP();
+                if (IS_NUMBER(a) & IS_NUMBER(b)) {
+                    PUSH(BOOL_VAL(AS_NUMBER(a) != AS_NUMBER(b)));
+                } else {
+                    DEOPTIMIZE(OP_NOT_EQUAL);
+                    PUSH(BOOL_VAL(!values_equal(a, b)));
+                }
+                NEXT();
+            }
+            CASE(OP_NEGATE_NUM) {
+                Value a = PEEK(0);
+                if (!IS_NUMBER(a)) {
+                    DEOPTIMIZE(OP_NEGATE);
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+                stack_top[-1] = NUMBER_VAL(-AS_NUMBER(a));
+                NEXT();
+            }
+
+            CASE(OP_RETURN) {
+                STORE_FRAME();
+                FINISH_PROFILE();
+                vm->result = pop(vm);
+                return INTERPRET_OK;
+            }
+#ifndef COMPUTED_GOTO
+        }
+    }
+#endif
+
+#undef NEXT
+#undef CASE
+#undef DISPATCH
+#undef FINISH_PROFILE
+#undef PROFILE_INSTRUCTION
+#undef TRACE_INSTRUCTION
+#undef NEGATED_COMPARISON_OP
+#undef NUMBER_OP
+#undef BINARY_OP
+#undef DEOPTIMIZE
+#undef QUICKEN
+#undef RUNTIME_ERROR
+#undef STORE_FRAME
+#undef PEEK
+#undef POP
+#undef PUSH
+#undef READ_CONSTANT_LONG
+#undef READ_CONSTANT
+#undef READ_BYTE
+}
+
+#undef VM_LOOP_PROFILED
+#undef VM_LOOP_TRACED
+#undef VM_LOOP_FUNCTION